@@ -9,67 +9,1307 @@
 
 #include "libDefs.h"
 #include "A2A3D.h"
+#include "decomposition.h" /* For the block distribution */
+#include "alltoall.h"
+#include "timers.h"
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int performDistTranspose(complexType *data, complexType *dataBuffer, int domainSize[2], int extent,
-                         ataInfo *thisATA)
-{ /* Performs the whole tranpose, all to all, rearranging etc. Called from main.c */
-	int elements;
-	int err;
+/* Persistent collectives are standard from MPI-4. Open MPI has had them as *
+ *  an extension since 4.0, so we use that where it's available.            */
+#if MPI_VERSION >= 4
+	#define HAS_PERSISTENT_ATA
+	#define alltoallInit MPI_Alltoall_init
+	#define alltoallvInit MPI_Alltoallv_init
+#elif defined(OPEN_MPI)
+	#include <mpi-ext.h>
+	#ifdef OMPI_HAVE_MPI_EXT_PCOLLREQ
+		#define HAS_PERSISTENT_ATA
+		#define alltoallInit MPIX_Alltoall_init
+		#define alltoallvInit MPIX_Alltoallv_init
+	#endif
+#endif
+
+/* A list of copies between two buffers, in reals */
+typedef struct {
+	int blocks;
+	int *from, *to, *length;
+} blockCopies;
+
+/* The two-level all-to-all of ENGINE_HIERARCHICAL. Each node's peers gather     *
+ *  everything they send onto the first of them, the leader, which sorts it by   *
+ *  the node it's going to. The leaders exchange it, sort what they get by the   *
+ *  peer it's for, and scatter it. The leader's tables are in reals, indexed by *
+ *  the peers on its node or by node, and are NULL on the other peers.          */
+struct ataHierarchy {
+	MPI_Comm nodeComm;    /* This node's peers                               */
+	MPI_Comm leaderComm;  /* The leaders, or MPI_COMM_NULL on the rest       */
+	int sendTotal, recvTotal; /* Sent and received by this peer altogether  */
+	
+	int *gatherCounts, *gatherOffsets;   /* Each local peer's part of gathered  */
+	int *scatterCounts, *scatterOffsets; /*  and of sorted, to scatter          */
+	int *exchangeSendCounts, *exchangeSendOffsets; /* Each node's part of the  */
+	int *exchangeRecvCounts, *exchangeRecvOffsets; /*  exchange                */
+	blockCopies byNode;  /* From gathered to sorted, for the exchange  */
+	blockCopies byPeer;  /* From gathered to sorted, to scatter        */
+	realType *gathered, *sorted;
+};
+
+/* What ENGINE_SHARED needs to read the packed buffers of the peers on its node *
+ *  straight out of their windows, and to exchange blocks with the rest by MPI. *
+ *  Offsets are in reals, and tables are indexed by peer.                       */
+struct ataShared {
+	MPI_Comm nodeComm;         /* This node's peers                                 */
+	MPI_Win windows[2];        /* Holding data[0] and data[1], over the whole node  */
+	complexType **peerData[2]; /* Each peer's data[b], or NULL if on another node   */
+	int *peerOffsets;          /* Where our block is in each peer's packed buffer   */
+	int *incomingOffsets;      /* Where each off-node peer's block lands in incoming */
+	realType *incoming;
+	MPI_Request *requests;     /* A send and a receive for each off-node peer       */
+};
+
+/* What ENGINE_RMA puts through. The data arrays are exposed in a window each, *
+ *  and each peer's block is put with the layout of its run along every row   *
+ *  of the peer's result.                                                     */
+struct ataRMA {
+	MPI_Win windows[2];          /* Over data[0] and data[1]            */
+	MPI_Datatype *targetTypes;   /* Where our block goes at each peer  */
+};
+
+static int *allocPeerTable(int peers)
+{
+	int *table = malloc(peers * sizeof(int));
+	if (table == NULL)
+	{
+		fprintf(stderr, "Unable to alloc peer table in routine makeATAlayout (A2A3D.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	return table;
+}
+
+void makeATAlayout(ataInfo *thisATA, int domainSize[2], int extent, int gatherExtent)
+{ /* Works out who gets what in a transpose of data shaped as domainSize and   *
+   *  extent. The FFT axis is shared out between the peers in blocks, and the *
+   *  new one, gatherExtent long, is made up of each peer's rows (or planes). *
+   * Blocks go to the peers in order, so the all-to-all counts and offsets    *
+   *  follow from the block sizes. They are in reals, as elsewhere.           */
+	int p;
+	int peers, rank;
+	int share;  /* Of the old FFT axis, left here       */
+	int other;  /* The axis the transpose doesn't touch */
+	
+	MPI_Comm_size(thisATA->comm, &peers);
+	MPI_Comm_rank(thisATA->comm, &rank);
+	thisATA->peers = peers;
+	thisATA->rank  = rank;
+	thisATA->gatherExtent = gatherExtent;
+	thisATA->even = ( extent % peers == 0 ) && ( gatherExtent % peers == 0 );
+	
+	thisATA->scatterCounts = allocPeerTable(peers);
+	thisATA->scatterStarts = allocPeerTable(peers);
+	thisATA->gatherCounts  = allocPeerTable(peers);
+	thisATA->gatherStarts  = allocPeerTable(peers);
+	thisATA->sendCounts    = allocPeerTable(peers);
+	thisATA->sendOffsets   = allocPeerTable(peers);
+	thisATA->recvCounts    = allocPeerTable(peers);
+	thisATA->recvOffsets   = allocPeerTable(peers);
+	thisATA->groupSendCounts = NULL;
+	
+	for(p=0;p<peers;p++)
+	{
+		thisATA->scatterCounts[p] = blockSize(extent, peers, p);
+		thisATA->scatterStarts[p] = blockStart(extent, peers, p);
+		thisATA->gatherCounts[p]  = blockSize(gatherExtent, peers, p);
+		thisATA->gatherStarts[p]  = blockStart(gatherExtent, peers, p);
+	}
+	
+	share = thisATA->scatterCounts[rank];
+	other = (thisATA->rearrangeDirection == ROWS) ? domainSize[1] : domainSize[0];
 	
+	for(p=0;p<peers;p++)
+	{
+		thisATA->sendCounts[p]  = 2 * domainSize[0] * domainSize[1] * thisATA->scatterCounts[p];
+		thisATA->sendOffsets[p] = 2 * domainSize[0] * domainSize[1] * thisATA->scatterStarts[p];
+		thisATA->recvCounts[p]  = 2 * share * other * thisATA->gatherCounts[p];
+		thisATA->recvOffsets[p] = 2 * share * other * thisATA->gatherStarts[p];
+	}
+}
+
+void transposedShape(ataInfo *thisATA, int domainSize[2], int extent, 
+                     int outDomain[2], int *outExtent)
+{ /* Works out the local shape a transpose leaves behind. The FFT axis is   *
+   *  shared out between the peers and becomes the row (or plane) axis,    *
+   *  while the rows (or planes) of all the peers are gathered together    *
+   *  into the new FFT axis. Only valid for the shape given to             *
+   *  makeATAlayout.                                                       */
 	if (thisATA->rearrangeDirection == ROWS)
 	{
-		ataRowRearrange(data, dataBuffer, domainSize, extent);
-		elements = domainSize[0] * domainSize[0] * domainSize[1];
-	} else if (thisATA->rearrangeDirection == COLS)
+		outDomain[0] = thisATA->scatterCounts[thisATA->rank];
+		outDomain[1] = domainSize[1];
+	} else {
+		outDomain[0] = domainSize[0];
+		outDomain[1] = thisATA->scatterCounts[thisATA->rank];
+	}
+	*outExtent = thisATA->gatherExtent;
+}
+
+static void copyBlocks(realType *in, realType *out, blockCopies *copies)
+{
+	int b;
+	
+	OMP_FOR()
+	for(b=0;b<copies->blocks;b++)
+	{
+		memcpy(out + copies->to[b], in + copies->from[b], copies->length[b] * sizeof(realType));
+	}
+}
+
+static void alltoallHierarchically(realType *send, realType *recv, ataHierarchy *hier)
+{ /* Does the same as the MPI_Alltoallv of transposeByPacking, in three steps,  *
+   *  so that only the leaders' messages cross between nodes - one to each      *
+   *  other node, rather than one from every peer to every peer on it.          */
+	MPI_Gatherv(send, hier->sendTotal, REAL_MPI_TYPE, 
+	            hier->gathered, hier->gatherCounts, hier->gatherOffsets, REAL_MPI_TYPE, 0, hier->nodeComm);
+	
+	if (hier->leaderComm != MPI_COMM_NULL)
+	{
+		copyBlocks(hier->gathered, hier->sorted, &hier->byNode);
+		MPI_Alltoallv(hier->sorted, hier->exchangeSendCounts, hier->exchangeSendOffsets, REAL_MPI_TYPE, 
+		              hier->gathered, hier->exchangeRecvCounts, hier->exchangeRecvOffsets, REAL_MPI_TYPE, 
+		              hier->leaderComm);
+		copyBlocks(hier->gathered, hier->sorted, &hier->byPeer);
+	}
+	
+	MPI_Scatterv(hier->sorted, hier->scatterCounts, hier->scatterOffsets, REAL_MPI_TYPE, 
+	             recv, hier->recvTotal, REAL_MPI_TYPE, 0, hier->nodeComm);
+}
+
+#ifdef SUBPHASE_TIMERS
+static double arrayBytes(int domainSize[2], int extent)
+{ /* What a pack or unpack of the whole array moves, for its bandwidth */
+	return (double)domainSize[0] * domainSize[1] * extent * sizeof(complexType);
+}
+
+static double bytesOnWire(ataInfo *thisATA)
+{ /* What we send the other peers through MPI, for TIMER_WIRE's bandwidth. Our *
+   *  own block never leaves, and ENGINE_SHARED's peers on the node read theirs. */
+	double reals = 0;
+	int p;
+	
+	for(p=0;p<thisATA->peers;p++)
+	{
+		if (p == thisATA->rank) continue;
+		if ( ( thisATA->shared != NULL ) && ( thisATA->shared->peerData[0][p] != NULL ) ) continue;
+		reals += thisATA->sendCounts[p];
+	}
+	return reals * sizeof(realType);
+}
+#endif
+
+static void packForTranspose(complexType *dataIn, complexType *dataBuffer, int domainSize[2], 
+                             int extent, ataInfo *thisATA)
+{ /* Rearranges into blocks for each peer, in the order of their offsets */
+	if (thisATA->rearrangeDirection == ROWS)
 	{
-		ataColRearrange(data, dataBuffer, domainSize, extent);
-		elements = domainSize[0] * domainSize[1] * domainSize[1];
+		if (thisATA->packMethod == PACK_SCALAR)
+			ataRowRearrangeScalar(dataIn, dataBuffer, domainSize, extent, thisATA);
+		else
+			ataRowRearrange(dataIn, dataBuffer, domainSize, extent, thisATA);
+	} else {
+		if (thisATA->packMethod == PACK_SCALAR)
+			ataColRearrangeScalar(dataIn, dataBuffer, domainSize, extent, thisATA);
+		else
+			ataColRearrange(dataIn, dataBuffer, domainSize, extent, thisATA);
 	}
+}
+
+static void transposeByPacking(complexType *data[2], int live, int domainSize[2], 
+                               int extent, ataInfo *thisATA)
+{ /* Rearranges into the other buffer, all-to-alls back into data[live], *
+   *  then unpacks into the other buffer again.                          */
+	complexType *dataIn = data[live];
+	complexType *dataBuffer = data[1 - live];
 	
-	err = MPI_Alltoall(dataBuffer, elements * 2, MPI_DOUBLE, 
-	             data, elements * 2, MPI_DOUBLE, thisATA->comm);
+	TIMER_START(TIMER_PACK);
+	packForTranspose(dataIn, dataBuffer, domainSize, extent, thisATA);
+	TIMER_STOP(TIMER_PACK, arrayBytes(domainSize, extent));
+	
+	TIMER_START(TIMER_WIRE);
+	if (thisATA->engine == ENGINE_PERSISTENT)
+	{ /* Set up by prepareATAengine with these same buffers */
+		MPI_Start(&thisATA->persistent[live]);
+		MPI_Wait(&thisATA->persistent[live], MPI_STATUS_IGNORE);
+	} else if (thisATA->engine == ENGINE_HIERARCHICAL) {
+		alltoallHierarchically((realType *)dataBuffer, (realType *)dataIn, thisATA->hierarchy);
+	} else if (thisATA->engine == ENGINE_PAIRWISE) {
+		alltoallPairwise((realType *)dataBuffer, (realType *)dataIn, thisATA);
+	} else if (thisATA->engine == ENGINE_BRUCK) {
+		alltoallBruck((realType *)dataBuffer, (realType *)dataIn, thisATA);
+	} else if (thisATA->engine == ENGINE_WINDOWED) {
+		alltoallWindowed((realType *)dataBuffer, (realType *)dataIn, thisATA);
+	} else if (thisATA->even) {
+		/* Every peer's share is the same, so the plain all-to-all will do - *
+		 *  libraries often tune it better than the v version.              */
+		MPI_Alltoall(dataBuffer, thisATA->sendCounts[0], REAL_MPI_TYPE, 
+		             dataIn, thisATA->recvCounts[0], REAL_MPI_TYPE, thisATA->comm);
+	} else {
+		MPI_Alltoallv(dataBuffer, thisATA->sendCounts, thisATA->sendOffsets, REAL_MPI_TYPE, 
+		              dataIn, thisATA->recvCounts, thisATA->recvOffsets, REAL_MPI_TYPE, 
+		              thisATA->comm);
+	}
+	TIMER_STOP(TIMER_WIRE, bytesOnWire(thisATA));
 	
+	TIMER_START(TIMER_UNPACK);
 	if (thisATA->rearrangeDirection == ROWS)
 	{
-		ataRowUnpack(data, dataBuffer, domainSize, extent);
-	} else if (thisATA->rearrangeDirection == COLS)
+		if (thisATA->packMethod == PACK_SCALAR)
+			ataRowUnpackScalar(dataIn, dataBuffer, domainSize, extent, thisATA);
+		else
+			ataRowUnpack(dataIn, dataBuffer, domainSize, extent, thisATA);
+	} else {
+		if (thisATA->packMethod == PACK_SCALAR)
+			ataColUnpackScalar(dataIn, dataBuffer, domainSize, extent, thisATA);
+		else
+			ataColUnpack(dataIn, dataBuffer, domainSize, extent, thisATA);
+	}
+	TIMER_STOP(TIMER_UNPACK, arrayBytes(domainSize, extent));
+}
+
+static int transposeShared(complexType *data[2], int live, int domainSize[2], 
+                           int extent, ataInfo *thisATA)
+{ /* Rearranges into the other buffer, as transposeByPacking does, but the    *
+   *  peers on this node then unpack their blocks straight out of each       *
+   *  other's, into data[live] - free once packed. Only the blocks for other *
+   *  nodes go through MPI, and they're unpacked as they arrive. Returns     *
+   *  live, since that's where the result is.                                */
+	ataShared *shared = thisATA->shared;
+	complexType *dataIn = data[live];
+	complexType *dataBuffer = data[1 - live];
+	realType *packed;
+	int p, requests = 0;
+	
+	TIMER_START(TIMER_PACK);
+	packForTranspose(dataIn, dataBuffer, domainSize, extent, thisATA);
+	TIMER_STOP(TIMER_PACK, arrayBytes(domainSize, extent));
+	
+	/* Waiting for the node to have packed counts as wire time, as the fences do for ENGINE_RMA */
+	TIMER_START(TIMER_WIRE);
+	for(p=0;p<thisATA->peers;p++)
+	{
+		if (shared->peerData[0][p] != NULL) continue;
+		MPI_Irecv(shared->incoming + shared->incomingOffsets[p], thisATA->recvCounts[p], REAL_MPI_TYPE, 
+		          p, 0, thisATA->comm, &shared->requests[requests++]);
+		MPI_Isend((realType *)dataBuffer + thisATA->sendOffsets[p], thisATA->sendCounts[p], REAL_MPI_TYPE, 
+		          p, 0, thisATA->comm, &shared->requests[requests++]);
+	}
+	
+	/* Everyone on the node has to have packed before anyone reads */
+	MPI_Win_sync(shared->windows[1 - live]);
+	MPI_Barrier(shared->nodeComm);
+	MPI_Win_sync(shared->windows[1 - live]);
+	TIMER_STOP(TIMER_WIRE, 0);
+	
+	TIMER_START(TIMER_UNPACK);
+	for(p=0;p<thisATA->peers;p++)
+	{
+		if (shared->peerData[0][p] == NULL) continue;
+		packed = (realType *)shared->peerData[1 - live][p];
+		ataUnpackPeer((complexType *)(packed + shared->peerOffsets[p]), dataIn, domainSize, thisATA, p);
+	}
+	TIMER_STOP(TIMER_UNPACK, 0);
+	
+	TIMER_START(TIMER_WIRE);
+	MPI_Waitall(requests, shared->requests, MPI_STATUSES_IGNORE);
+	TIMER_STOP(TIMER_WIRE, bytesOnWire(thisATA));
+	
+	TIMER_START(TIMER_UNPACK);
+	for(p=0;p<thisATA->peers;p++)
 	{
-		ataColUnpack(data, dataBuffer, domainSize, extent);
+		if (shared->peerData[0][p] != NULL) continue;
+		ataUnpackPeer((complexType *)(shared->incoming + shared->incomingOffsets[p]), dataIn, 
+		              domainSize, thisATA, p);
 	}
+	TIMER_STOP(TIMER_UNPACK, arrayBytes(domainSize, extent));
 	
-	memcpy(data,dataBuffer,domainSize[0]*domainSize[1]*extent*sizeof(complexType));
+	/* and everyone has to have read before anyone packs, or plans with, the buffer again */
+	TIMER_START(TIMER_WIRE);
+	MPI_Barrier(shared->nodeComm);
+	TIMER_STOP(TIMER_WIRE, 0);
+	
+	return live;
+}
+
+static int transposeByPuts(complexType *data[2], int live, int domainSize[2], 
+                           int extent, ataInfo *thisATA)
+{ /* Rearranges into the other buffer, as transposeByPacking does, then puts *
+   *  each block into its unpacked place in the peer's data[live], which is  *
+   *  free once everyone has packed, so there's no unpack. Returns live,     *
+   *  since that's where the result is.                                      */
+	ataRMA *rma = thisATA->rma;
+	realType *packed = (realType *)data[1 - live];
+	int p;
+	
+	TIMER_START(TIMER_PACK);
+	packForTranspose(data[live], data[1 - live], domainSize, extent, thisATA);
+	TIMER_STOP(TIMER_PACK, arrayBytes(domainSize, extent));
+	
+	/* Opening the epoch waits for the peers to have packed, too */
+	TIMER_START(TIMER_WIRE);
+	MPI_Win_fence(MPI_MODE_NOPRECEDE, rma->windows[live]);
+	
+	for(p=0;p<thisATA->peers;p++)
+	{
+		MPI_Put(packed + thisATA->sendOffsets[p], thisATA->sendCounts[p], REAL_MPI_TYPE, 
+		        p, thisATA->gatherStarts[thisATA->rank], 1, rma->targetTypes[p], rma->windows[live]);
+	}
 	
+	/* Nothing here writes to data[live] until the puts into it are done */
+	MPI_Win_fence(MPI_MODE_NOSTORE | MPI_MODE_NOSUCCEED, rma->windows[live]);
+	TIMER_STOP(TIMER_WIRE, bytesOnWire(thisATA));
+	
+	return live;
+}
+
+static void transposeByDatatypes(complexType *data, complexType *dataBuffer, ataInfo *thisATA)
+{ /* The MPI library walks the layouts described in makeATAdatatypes itself, *
+   *  so the data goes straight from data to its unpacked place in dataBuffer, *
+   *  and the packing and unpacking are all timed as wire time.                */
+	TIMER_START(TIMER_WIRE);
+	MPI_Alltoallw(data, thisATA->counts, thisATA->sendDispls, thisATA->sendTypes,
+	              dataBuffer, thisATA->counts, thisATA->recvDispls, thisATA->recvTypes,
+	              thisATA->comm);
+	TIMER_STOP(TIMER_WIRE, bytesOnWire(thisATA));
+}
+
+int performDistTranspose(complexType *data[2], int live, int domainSize[2], int extent,
+                         ataInfo *thisATA)
+{ /* Performs the whole tranpose, all to all, rearranging etc. Called from main.c *
+   * Reads from data[live] and leaves the result in the other buffer, whose      *
+   *  index is returned - nothing is copied back. ENGINE_SHARED and ENGINE_RMA  *
+   *  are the exceptions, leaving it in data[live].                             */
+	
+	switch (thisATA->engine)
+	{
+		case ENGINE_SHARED:
+		 return transposeShared(data, live, domainSize, extent, thisATA);
+		 
+		case ENGINE_RMA:
+		 return transposeByPuts(data, live, domainSize, extent, thisATA);
+		 
+		case ENGINE_DATATYPE:
+		 transposeByDatatypes(data[live], data[1 - live], thisATA);
+		 break;
+		 
+		case ENGINE_PACK:
+		case ENGINE_PERSISTENT:
+		case ENGINE_HIERARCHICAL:
+		case ENGINE_PAIRWISE:
+		case ENGINE_BRUCK:
+		case ENGINE_WINDOWED:
+		default:
+		 transposeByPacking(data, live, domainSize, extent, thisATA);
+		 break;
+	}
+	
+	return 1 - live;
+}
+
+static void fftGroup(complexType *data[2], int live, int stage, int domainSize[2], int extent,
+                     int direction, int depth, int group)
+{ /* Runs the 1D FFTs of the given stage for the pencils in one pipeline group, *
+   *  in batches of d0/depth pencils. A row group is a run of whole planes; a   *
+   *  column group is a band of rows across every plane. Both are the same on  *
+   *  either side of their transpose, though the rows in a plane may not be.    */
+	int b, i;
+	int d0 = domainSize[0];
+	int d1 = domainSize[1];
+	int batchPencils = d0 / depth;
+	
+	if (direction == ROWS)
+	{
+		for(b=0;b<(d1/depth)*depth;b++)
+		{
+			performFFTbatch(data, live, stage, extent, group*(d1/depth)*d0 + b*batchPencils);
+		}
+	} else {
+		for(i=0;i<d1;i++)
+		{
+			performFFTbatch(data, live, stage, extent, i*d0 + group*batchPencils);
+		}
+	}
+}
+
+int performPipelinedTranspose(complexType *data[2], int live, int domainSize[2], int extent,
+                              ataInfo *thisATA, int fftBefore, int fftAfter, pipelineStats *stats)
+{ /* Splits the transpose into pipelineDepth groups of pencils, each with its own *
+   *  non-blocking all-to-all, so that communication overlaps with the FFTs       *
+   *  either side.                                                                *
+   * fftBefore and fftAfter are the FFT stages either side, or NO_FFT.            *
+   *  With fftBefore, each group's FFTs are run just before it is packed and      *
+   *  posted. With fftAfter, each group is transformed as soon as it has arrived  *
+   *  and been unpacked, in whichever order the groups complete.                  *
+   * Groups are packed into the shared staging buffer and received into the      *
+   *  other data buffer, each in its own region, so none of them overlap. Once    *
+   *  every group is packed the input is dead, so the result is unpacked back    *
+   *  into data[live], whose index is returned.                                   */
+	int g, arrived, flag;
+	int depth = thisATA->pipelineDepth;
+	int d0 = domainSize[0];
+	int d1 = domainSize[1];
+	int groupDims[2];
+	int outDomain[2], outExtent;
+	int inGroupElements, outGroupElements;
+	complexType *in   = data[live];
+	complexType *recv = data[1 - live];
+	double time, firstPost = 0, lastArrival = 0;
+	
+	transposedShape(thisATA, domainSize, extent, outDomain, &outExtent);
+	inGroupElements  = d0 * d1 * extent / depth;
+	outGroupElements = outDomain[0] * outDomain[1] * outExtent / depth;
+	
+	if (thisATA->rearrangeDirection == ROWS)
+	{
+		groupDims[0] = d0;
+		groupDims[1] = d1 / depth;
+	}
+	
+	for(g=0;g<depth;g++)
+	{
+		if (fftBefore != NO_FFT)
+		{
+			time = MPI_Wtime();
+			fftGroup(data, live, fftBefore, domainSize, extent, thisATA->rearrangeDirection, depth, g);
+			stats->fftTime += MPI_Wtime() - time;
+		}
+		
+		TIMER_START(TIMER_PACK);
+		if (thisATA->rearrangeDirection == ROWS)
+			ataRowRearrange(in + g*inGroupElements, thisATA->stage + g*inGroupElements, 
+			                groupDims, extent, thisATA);
+		else
+			ataColRearrangeGroup(in, thisATA->stage + g*inGroupElements, domainSize, extent, thisATA,
+			                     g*(d0/depth), d0/depth);
+		TIMER_STOP(TIMER_PACK, (double)inGroupElements * sizeof(complexType));
+		
+		/* Time inside MPI here counts as exposed, since nothing else is running. */
+		TIMER_START(TIMER_WIRE);
+		time = MPI_Wtime();
+		if (g == 0) firstPost = time;
+		if (thisATA->even)
+			MPI_Ialltoall(thisATA->stage + g*inGroupElements, thisATA->groupSendCounts[0], REAL_MPI_TYPE,
+			              recv + g*outGroupElements, thisATA->groupRecvCounts[0], REAL_MPI_TYPE,
+			              thisATA->comm, &thisATA->requests[g]);
+		else
+			MPI_Ialltoallv(thisATA->stage + g*inGroupElements, 
+			               thisATA->groupSendCounts, thisATA->groupSendOffsets, REAL_MPI_TYPE,
+			               recv + g*outGroupElements, 
+			               thisATA->groupRecvCounts, thisATA->groupRecvOffsets, REAL_MPI_TYPE,
+			               thisATA->comm, &thisATA->requests[g]);
+		
+		/* Many MPI libraries only progress non-blocking collectives from  *
+		 *  inside MPI calls. The group just posted is probed, since it's   *
+		 *  the one least likely to be done - probing a finished request    *
+		 *  can return without progressing the others at all. This doesn't *
+		 *  complete or free the request.                                   */
+		MPI_Request_get_status(thisATA->requests[g], &flag, MPI_STATUS_IGNORE);
+		stats->waitTime += MPI_Wtime() - time;
+		TIMER_STOP(TIMER_WIRE, bytesOnWire(thisATA) / depth);
+	}
+	
+	for(arrived=0;arrived<depth;arrived++)
+	{
+		TIMER_START(TIMER_WIRE);
+		time = MPI_Wtime();
+		MPI_Waitany(depth, thisATA->requests, &g, MPI_STATUS_IGNORE);
+		lastArrival = MPI_Wtime();
+		stats->waitTime += lastArrival - time;
+		TIMER_STOP(TIMER_WIRE, 0);
+		
+		TIMER_START(TIMER_UNPACK);
+		if (thisATA->rearrangeDirection == ROWS)
+			ataRowUnpack(recv + g*outGroupElements, in + g*outGroupElements, groupDims, extent, thisATA);
+		else
+			ataColUnpackGroup(recv + g*outGroupElements, in, domainSize, extent, thisATA,
+			                  g*(d0/depth), d0/depth);
+		TIMER_STOP(TIMER_UNPACK, (double)outGroupElements * sizeof(complexType));
+		
+		if (fftAfter != NO_FFT)
+		{
+			time = MPI_Wtime();
+			fftGroup(data, live, fftAfter, outDomain, outExtent, thisATA->rearrangeDirection, depth, g);
+			stats->fftTime += MPI_Wtime() - time;
+		}
+	}
+	stats->commSpan += lastArrival - firstPost;
+	
+	return live;
+}
+
+static void prepareGroupCounts(ataInfo *thisATA, int depth)
+{ /* A pipeline group is 1/depth of the planes (for rows) or of the rows   *
+   *  (for columns), which is a factor of every count and offset, so each *
+   *  group's are the whole transpose's divided by depth.                 */
+	int p;
+	
+	thisATA->groupSendCounts  = allocPeerTable(thisATA->peers);
+	thisATA->groupSendOffsets = allocPeerTable(thisATA->peers);
+	thisATA->groupRecvCounts  = allocPeerTable(thisATA->peers);
+	thisATA->groupRecvOffsets = allocPeerTable(thisATA->peers);
+	
+	for(p=0;p<thisATA->peers;p++)
+	{
+		thisATA->groupSendCounts[p]  = thisATA->sendCounts[p]  / depth;
+		thisATA->groupSendOffsets[p] = thisATA->sendOffsets[p] / depth;
+		thisATA->groupRecvCounts[p]  = thisATA->recvCounts[p]  / depth;
+		thisATA->groupRecvOffsets[p] = thisATA->recvOffsets[p] / depth;
+	}
+}
+
+void preparePipeline(ataInfo *ataRow, ataInfo *ataCol, int stageDomain[3][2], int stageExtent[3], 
+                     int depth)
+{ /* Sets up the shared staging buffer and request list for the pipelined  *
+   *  transposes, and each one's group counts. A depth of 0 means they     *
+   *  aren't used.                                                         */
+	int s;
+	long elements, largest = 0;
+	
+	ataRow->pipelineDepth = depth;
+	ataCol->pipelineDepth = depth;
+	ataRow->stage = NULL;
+	ataRow->requests = NULL;
+	
+	if (depth > 0)
+	{
+		/* With uneven blocks the local domain can grow at a transpose */
+		for(s=0;s<3;s++)
+		{
+			elements = (long)stageDomain[s][0] * stageDomain[s][1] * stageExtent[s];
+			if (elements > largest) largest = elements;
+		}
+		
+		ataRow->stage = malloc(largest * sizeof(complexType));
+		ataRow->requests = malloc(depth * sizeof(MPI_Request));
+		if ( ( ataRow->stage == NULL ) || ( ataRow->requests == NULL ) )
+		{
+			fprintf(stderr, "Could not allocate pipeline staging buffer.\n");
+			MPI_Abort(MPI_COMM_WORLD, 5);
+		}
+		prepareGroupCounts(ataRow, depth);
+		prepareGroupCounts(ataCol, depth);
+	}
+	ataCol->stage = ataRow->stage;
+	ataCol->requests = ataRow->requests;
+}
+
+void makeATAdatatypes(ataInfo *thisATA, int domainSize[2], int extent)
+{ /* Builds the send and receive layouts for ENGINE_DATATYPE, for the transpose *
+   *  laid out by makeATAlayout. The peers' shares can differ, so each has its  *
+   *  own pair of types.                                                        *
+   * The sender just hands over its (plane, row, element) subarray in memory     *
+   *  order. The receiver's type scatters that stream to where the unpack would *
+   *  have put it - the element index becomes the row index and the sender's    *
+   *  row (or plane, for columns) becomes the position along the new element    *
+   *  axis.                                                                     */
+	int p;
+	int peers = thisATA->peers;
+	int d0 = domainSize[0];
+	int d1 = domainSize[1];
+	int sizes[3], subsizes[3], starts[3] = {0,0,0};
+	int share;            /* Elements along the FFT axis left here              */
+	int outExtent;        /* Length of the new FFT axis                         */
+	MPI_Aint elementSize; /* Bytes in one complexType                            */
+	MPI_Datatype complexMPI, inner, middle;
+	
+	elementSize = sizeof(complexType);
+	share = thisATA->scatterCounts[thisATA->rank];
+	outExtent = thisATA->gatherExtent;
+	
+	/* As elsewhere, a complex number is assumed to be two reals - see REAL_MPI_TYPE. */
+	MPI_Type_contiguous(2, REAL_MPI_TYPE, &complexMPI);
+	
+	thisATA->sendTypes  = malloc(peers * sizeof(MPI_Datatype));
+	thisATA->recvTypes  = malloc(peers * sizeof(MPI_Datatype));
+	thisATA->counts     = malloc(peers * sizeof(int));
+	thisATA->sendDispls = malloc(peers * sizeof(int));
+	thisATA->recvDispls = malloc(peers * sizeof(int));
+	if ( ( thisATA->sendTypes == NULL ) || ( thisATA->recvTypes == NULL ) || 
+	     ( thisATA->counts == NULL ) || ( thisATA->sendDispls == NULL ) || 
+	     ( thisATA->recvDispls == NULL ) )
+	{
+		fprintf(stderr, "Unable to alloc datatype tables in routine makeATAdatatypes (A2A3D.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	
+	sizes[0] = d1;     subsizes[0] = d1;
+	sizes[1] = d0;     subsizes[1] = d0;
+	sizes[2] = extent;
+	
+	for(p=0;p<peers;p++)
+	{
+		subsizes[2] = thisATA->scatterCounts[p];
+		MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, complexMPI, &thisATA->sendTypes[p]);
+		
+		if (thisATA->rearrangeDirection == ROWS)
+		{ /* Incoming (i, j, kk) lands at [p][kk][start + j] */
+			MPI_Type_vector(share, 1, outExtent, complexMPI, &inner);
+			MPI_Type_create_hvector(thisATA->gatherCounts[p], 1, elementSize, inner, &middle);
+			MPI_Type_create_hvector(d1, 1, share * outExtent * elementSize, middle, &thisATA->recvTypes[p]);
+		} else {
+			/* Incoming (i, j, kk) lands at [kk][j][start + i] */
+			MPI_Type_vector(share, 1, d0 * outExtent, complexMPI, &inner);
+			MPI_Type_create_hvector(d0, 1, outExtent * elementSize, inner, &middle);
+			MPI_Type_create_hvector(thisATA->gatherCounts[p], 1, elementSize, middle, &thisATA->recvTypes[p]);
+		}
+		MPI_Type_commit(&thisATA->sendTypes[p]);
+		MPI_Type_commit(&thisATA->recvTypes[p]);
+		MPI_Type_free(&inner);
+		MPI_Type_free(&middle);
+		
+		/* Alltoallw displacements are in bytes */
+		thisATA->counts[p]     = 1;
+		thisATA->sendDispls[p] = thisATA->scatterStarts[p] * elementSize;
+		thisATA->recvDispls[p] = thisATA->gatherStarts[p] * elementSize;
+	}
+	MPI_Type_free(&complexMPI);
+}
+
+int persistentATAavailable()
+{ /* Whether ENGINE_PERSISTENT can be used with this MPI library */
+#ifdef HAS_PERSISTENT_ATA
+	return 1;
+#else
 	return 0;
+#endif
+}
+
+static void *allocEngine(size_t bytes)
+{
+	void *table = malloc(bytes);
+	if ( ( table == NULL ) && ( bytes > 0 ) )
+	{
+		fprintf(stderr, "Unable to alloc engine tables in routine prepareATAengine (A2A3D.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	return table;
+}
+
+static void prepareHierarchy(ataInfo *thisATA)
+{ /* Finds the nodes, and works out where each block goes on the way through    *
+   *  the leaders. Every peer sends its blocks in the order of their offsets,   *
+   *  which is the order of the peers, and receives them the same way. A       *
+   *  leader sends each other one the blocks for its peers in their order,     *
+   *  and within those, from its own peers in theirs.                          */
+	ataHierarchy *hier;
+	int peers = thisATA->peers;
+	int local, localPeers, node, nodes;
+	int m, p, q, n, b;
+	int offset;
+	int *nodeOf;                 /* Every peer's node                            */
+	int *sendTable, *recvTable;  /* Each local peer's send and receive counts,  */
+	int *sendStart, *recvStart;  /*  and offsets                                */
+	
+	hier = allocEngine(sizeof(ataHierarchy));
+	thisATA->hierarchy = hier;
+	
+	/* The leader of each node is its lowest ranked peer, and the nodes are *
+	 *  numbered in the order of their leaders.                             */
+	MPI_Comm_split_type(thisATA->comm, MPI_COMM_TYPE_SHARED, thisATA->rank, MPI_INFO_NULL, &hier->nodeComm);
+	MPI_Comm_rank(hier->nodeComm, &local);
+	MPI_Comm_size(hier->nodeComm, &localPeers);
+	MPI_Comm_split(thisATA->comm, ( local == 0 ) ? 0 : MPI_UNDEFINED, thisATA->rank, &hier->leaderComm);
+	if (local == 0)
+	{
+		MPI_Comm_rank(hier->leaderComm, &node);
+		MPI_Comm_size(hier->leaderComm, &nodes);
+	}
+	MPI_Bcast(&node, 1, MPI_INT, 0, hier->nodeComm);
+	MPI_Bcast(&nodes, 1, MPI_INT, 0, hier->nodeComm);
+	
+	nodeOf = allocPeerTable(peers);
+	MPI_Allgather(&node, 1, MPI_INT, nodeOf, 1, MPI_INT, thisATA->comm);
+	
+	hier->sendTotal = 0;
+	hier->recvTotal = 0;
+	for(p=0;p<peers;p++)
+	{
+		hier->sendTotal += thisATA->sendCounts[p];
+		hier->recvTotal += thisATA->recvCounts[p];
+	}
+	
+	/* The local peers' ranks are in the order of their ranks in the whole *
+	 *  communicator, so their counts can be gathered as they are.         */
+	sendTable = ( local == 0 ) ? allocEngine(localPeers * peers * sizeof(int)) : NULL;
+	recvTable = ( local == 0 ) ? allocEngine(localPeers * peers * sizeof(int)) : NULL;
+	MPI_Gather(thisATA->sendCounts, peers, MPI_INT, sendTable, peers, MPI_INT, 0, hier->nodeComm);
+	MPI_Gather(thisATA->recvCounts, peers, MPI_INT, recvTable, peers, MPI_INT, 0, hier->nodeComm);
+	
+	hier->gatherCounts   = NULL;
+	hier->gatherOffsets  = NULL;
+	hier->scatterCounts  = NULL;
+	hier->scatterOffsets = NULL;
+	hier->exchangeSendCounts  = NULL;
+	hier->exchangeSendOffsets = NULL;
+	hier->exchangeRecvCounts  = NULL;
+	hier->exchangeRecvOffsets = NULL;
+	hier->byNode.blocks = 0;
+	hier->byNode.from   = NULL;
+	hier->byNode.to     = NULL;
+	hier->byNode.length = NULL;
+	hier->byPeer = hier->byNode;
+	hier->gathered = NULL;
+	hier->sorted   = NULL;
+	
+	if (local == 0)
+	{
+		hier->gatherCounts   = allocPeerTable(localPeers);
+		hier->gatherOffsets  = allocPeerTable(localPeers);
+		hier->scatterCounts  = allocPeerTable(localPeers);
+		hier->scatterOffsets = allocPeerTable(localPeers);
+		hier->exchangeSendCounts  = allocPeerTable(nodes);
+		hier->exchangeSendOffsets = allocPeerTable(nodes);
+		hier->exchangeRecvCounts  = allocPeerTable(nodes);
+		hier->exchangeRecvOffsets = allocPeerTable(nodes);
+		sendStart = allocPeerTable(localPeers * peers);
+		recvStart = allocPeerTable(localPeers * peers);
+		
+		/* Where each local peer's blocks are in what's gathered and scattered */
+		for(m=0;m<localPeers;m++)
+		{
+			hier->gatherCounts[m]  = 0;
+			hier->scatterCounts[m] = 0;
+			for(p=0;p<peers;p++)
+			{
+				sendStart[m*peers + p] = hier->gatherCounts[m];
+				recvStart[m*peers + p] = hier->scatterCounts[m];
+				hier->gatherCounts[m]  += sendTable[m*peers + p];
+				hier->scatterCounts[m] += recvTable[m*peers + p];
+			}
+			hier->gatherOffsets[m]  = ( m == 0 ) ? 0 : hier->gatherOffsets[m - 1] + hier->gatherCounts[m - 1];
+			hier->scatterOffsets[m] = ( m == 0 ) ? 0 : hier->scatterOffsets[m - 1] + hier->scatterCounts[m - 1];
+		}
+		
+		hier->byNode.blocks = localPeers * peers;
+		hier->byNode.from   = allocPeerTable(localPeers * peers);
+		hier->byNode.to     = allocPeerTable(localPeers * peers);
+		hier->byNode.length = allocPeerTable(localPeers * peers);
+		hier->byPeer.blocks = localPeers * peers;
+		hier->byPeer.from   = allocPeerTable(localPeers * peers);
+		hier->byPeer.to     = allocPeerTable(localPeers * peers);
+		hier->byPeer.length = allocPeerTable(localPeers * peers);
+		
+		/* Going out, for each node, for each of its peers, from each local peer */
+		offset = 0;
+		b = 0;
+		for(n=0;n<nodes;n++)
+		{
+			hier->exchangeSendOffsets[n] = offset;
+			for(p=0;p<peers;p++)
+			{
+				if (nodeOf[p] != n) continue;
+				for(m=0;m<localPeers;m++)
+				{
+					hier->byNode.from[b]   = hier->gatherOffsets[m] + sendStart[m*peers + p];
+					hier->byNode.to[b]     = offset;
+					hier->byNode.length[b] = sendTable[m*peers + p];
+					offset += sendTable[m*peers + p];
+					b++;
+				}
+			}
+			hier->exchangeSendCounts[n] = offset - hier->exchangeSendOffsets[n];
+		}
+		
+		/* Coming in, from each node, for each local peer, from each of the node's */
+		offset = 0;
+		b = 0;
+		for(n=0;n<nodes;n++)
+		{
+			hier->exchangeRecvOffsets[n] = offset;
+			for(m=0;m<localPeers;m++)
+			{
+				for(q=0;q<peers;q++)
+				{
+					if (nodeOf[q] != n) continue;
+					hier->byPeer.from[b]   = offset;
+					hier->byPeer.to[b]     = hier->scatterOffsets[m] + recvStart[m*peers + q];
+					hier->byPeer.length[b] = recvTable[m*peers + q];
+					offset += recvTable[m*peers + q];
+					b++;
+				}
+			}
+			hier->exchangeRecvCounts[n] = offset - hier->exchangeRecvOffsets[n];
+		}
+		
+		/* Both buffers hold everything sent and everything received, at some point */
+		offset = hier->gatherOffsets[localPeers - 1] + hier->gatherCounts[localPeers - 1];
+		if ( offset < hier->scatterOffsets[localPeers - 1] + hier->scatterCounts[localPeers - 1] )
+			offset = hier->scatterOffsets[localPeers - 1] + hier->scatterCounts[localPeers - 1];
+		hier->gathered = allocEngine(offset * sizeof(realType));
+		hier->sorted   = allocEngine(offset * sizeof(realType));
+		
+		free(sendStart);
+		free(recvStart);
+	}
+	
+	free(nodeOf);
+	free(sendTable);
+	free(recvTable);
+}
+
+static void freeHierarchy(ataInfo *thisATA)
+{
+	ataHierarchy *hier = thisATA->hierarchy;
+	
+	if (hier == NULL) return;
+	
+	free(hier->gatherCounts);
+	free(hier->gatherOffsets);
+	free(hier->scatterCounts);
+	free(hier->scatterOffsets);
+	free(hier->exchangeSendCounts);
+	free(hier->exchangeSendOffsets);
+	free(hier->exchangeRecvCounts);
+	free(hier->exchangeRecvOffsets);
+	free(hier->byNode.from);
+	free(hier->byNode.to);
+	free(hier->byNode.length);
+	free(hier->byPeer.from);
+	free(hier->byPeer.to);
+	free(hier->byPeer.length);
+	free(hier->gathered);
+	free(hier->sorted);
+	
+	MPI_Comm_free(&hier->nodeComm);
+	if (hier->leaderComm != MPI_COMM_NULL)
+		MPI_Comm_free(&hier->leaderComm);
+	free(hier);
+	thisATA->hierarchy = NULL;
+}
+
+static void prepareShared(ataInfo *thisATA, MPI_Win windows[2])
+{ /* Finds which peers are in this node's windows, and where their data arrays  *
+   *  are, and where in each of their packed buffers our block will be. The    *
+   *  blocks for the peers on other nodes are sent, and those from them land   *
+   *  in a buffer of their own, one after another.                             */
+	ataShared *shared;
+	int peers = thisATA->peers;
+	int p, b, offset, unit;
+	int *ranks, *nodeRanks;
+	MPI_Group group, nodeGroup;
+	MPI_Aint bytes;
+	
+	shared = allocEngine(sizeof(ataShared));
+	thisATA->shared = shared;
+	shared->windows[0] = windows[0];
+	shared->windows[1] = windows[1];
+	MPI_Comm_split_type(thisATA->comm, MPI_COMM_TYPE_SHARED, thisATA->rank, MPI_INFO_NULL, &shared->nodeComm);
+	
+	/* The windows are over every processor on the node, not just these peers */
+	ranks     = allocPeerTable(peers);
+	nodeRanks = allocPeerTable(peers);
+	for(p=0;p<peers;p++) ranks[p] = p;
+	MPI_Comm_group(thisATA->comm, &group);
+	MPI_Win_get_group(windows[0], &nodeGroup);
+	MPI_Group_translate_ranks(group, peers, ranks, nodeGroup, nodeRanks);
+	MPI_Group_free(&group);
+	MPI_Group_free(&nodeGroup);
+	
+	for(b=0;b<2;b++)
+	{
+		shared->peerData[b] = allocEngine(peers * sizeof(complexType *));
+		for(p=0;p<peers;p++)
+		{
+			if (nodeRanks[p] == MPI_UNDEFINED)
+				shared->peerData[b][p] = NULL;
+			else
+				MPI_Win_shared_query(windows[b], nodeRanks[p], &bytes, &unit, &shared->peerData[b][p]);
+		}
+	}
+	
+	/* Each peer's block for us starts at its own send offset for us */
+	shared->peerOffsets = allocPeerTable(peers);
+	MPI_Alltoall(thisATA->sendOffsets, 1, MPI_INT, shared->peerOffsets, 1, MPI_INT, thisATA->comm);
+	
+	shared->incomingOffsets = allocPeerTable(peers);
+	offset = 0;
+	for(p=0;p<peers;p++)
+	{
+		shared->incomingOffsets[p] = offset;
+		if (shared->peerData[0][p] == NULL) offset += thisATA->recvCounts[p];
+	}
+	shared->incoming = allocEngine(offset * sizeof(realType));
+	shared->requests = allocEngine(2 * peers * sizeof(MPI_Request));
+	
+	free(ranks);
+	free(nodeRanks);
+}
+
+static void freeShared(ataInfo *thisATA)
+{
+	ataShared *shared = thisATA->shared;
+	
+	if (shared == NULL) return;
+	
+	free(shared->peerData[0]);
+	free(shared->peerData[1]);
+	free(shared->peerOffsets);
+	free(shared->incomingOffsets);
+	free(shared->incoming);
+	free(shared->requests);
+	MPI_Comm_free(&shared->nodeComm);
+	free(shared);
+	thisATA->shared = NULL;
+}
+
+static void prepareRMA(ataInfo *thisATA, complexType *data[2], int domainSize[2])
+{ /* Exposes the part of each data array that holds a transpose's result, and *
+   *  describes where our block goes in each peer's - the same run, along     *
+   *  every one of its rows. Only fences are used, so there are no locks.     */
+	ataRMA *rma;
+	int peers = thisATA->peers;
+	int p, b;
+	int other = (thisATA->rearrangeDirection == ROWS) ? domainSize[1] : domainSize[0];
+	MPI_Aint resultSize = (MPI_Aint)other * thisATA->scatterCounts[thisATA->rank] * 
+	                      thisATA->gatherExtent * sizeof(complexType);
+	MPI_Info info;
+	
+	rma = allocEngine(sizeof(ataRMA));
+	thisATA->rma = rma;
+	
+	MPI_Info_create(&info);
+	MPI_Info_set(info, "no_locks", "true");
+	for(b=0;b<2;b++)
+		MPI_Win_create(data[b], resultSize, sizeof(complexType), info, thisATA->comm, &rma->windows[b]);
+	MPI_Info_free(&info);
+	
+	/* In reals, as the packed blocks are. The peers all share the untouched axis. */
+	rma->targetTypes = allocEngine(peers * sizeof(MPI_Datatype));
+	for(p=0;p<peers;p++)
+	{
+		MPI_Type_vector(other * thisATA->scatterCounts[p], 2 * thisATA->gatherCounts[thisATA->rank], 
+		                2 * thisATA->gatherExtent, REAL_MPI_TYPE, &rma->targetTypes[p]);
+		MPI_Type_commit(&rma->targetTypes[p]);
+	}
 }
 
-void ataRowRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent)
+static void freeRMA(ataInfo *thisATA)
+{
+	ataRMA *rma = thisATA->rma;
+	int p;
+	
+	if (rma == NULL) return;
+	
+	for(p=0;p<thisATA->peers;p++)
+		MPI_Type_free(&rma->targetTypes[p]);
+	free(rma->targetTypes);
+	MPI_Win_free(&rma->windows[0]);
+	MPI_Win_free(&rma->windows[1]);
+	free(rma);
+	thisATA->rma = NULL;
+}
+
+void prepareATAengine(ataInfo *thisATA, complexType *data[2], MPI_Win windows[2], 
+                      int domainSize[2], int extent)
+{ /* Sets up whatever the transpose engine needs beyond the layouts made with   *
+   *  the decomposition.                                                        *
+   * ENGINE_PERSISTENT creates its persistent all-to-alls here. With the data   *
+   *  in buffer b, the packed data is in the other buffer and is sent back into *
+   *  b, so there is one request for each starting buffer.                      *
+   * ENGINE_HIERARCHICAL finds which peers share a node - see prepareHierarchy. *
+   * ENGINE_SHARED needs data to have been made by makeSharedDataArrays, with   *
+   *  these windows, which are otherwise unused - see prepareShared.            *
+   * ENGINE_RMA makes windows of its own over data - see prepareRMA.            *
+   * ENGINE_BRUCK and ENGINE_WINDOWED need buffers - see prepareExchange.       */
+	int b;
+	
+	thisATA->persistent[0] = MPI_REQUEST_NULL;
+	thisATA->persistent[1] = MPI_REQUEST_NULL;
+	thisATA->hierarchy = NULL;
+	thisATA->shared = NULL;
+	thisATA->rma = NULL;
+	thisATA->exchange = NULL;
+	
+	if (thisATA->engine == ENGINE_HIERARCHICAL)
+		prepareHierarchy(thisATA);
+	if (thisATA->engine == ENGINE_SHARED)
+		prepareShared(thisATA, windows);
+	if (thisATA->engine == ENGINE_RMA)
+		prepareRMA(thisATA, data, domainSize);
+	if ( (thisATA->engine == ENGINE_BRUCK) || (thisATA->engine == ENGINE_WINDOWED) )
+		prepareExchange(thisATA, domainSize);
+	
+#ifdef HAS_PERSISTENT_ATA
+	if (thisATA->engine == ENGINE_PERSISTENT)
+	{
+		for(b=0;b<2;b++)
+		{
+			if (thisATA->even)
+				alltoallInit(data[1 - b], thisATA->sendCounts[0], REAL_MPI_TYPE, 
+				             data[b], thisATA->recvCounts[0], REAL_MPI_TYPE, 
+				             thisATA->comm, MPI_INFO_NULL, &thisATA->persistent[b]);
+			else
+				alltoallvInit(data[1 - b], thisATA->sendCounts, thisATA->sendOffsets, REAL_MPI_TYPE, 
+				              data[b], thisATA->recvCounts, thisATA->recvOffsets, REAL_MPI_TYPE, 
+				              thisATA->comm, MPI_INFO_NULL, &thisATA->persistent[b]);
+		}
+	}
+#endif
+}
+
+void transposeVolume(ataInfo *thisATA, int node, double *sent, double *offNode)
+{ /* Adds the bytes one transpose sends from this processor to the other peers *
+   *  to sent, and those of them that leave the node to offNode. node is this  *
+   *  processor's - see nodeInfo. Every peer has to call this together.        */
+	int *nodes = allocPeerTable(thisATA->peers);
+	int p;
+	
+	MPI_Allgather(&node, 1, MPI_INT, nodes, 1, MPI_INT, thisATA->comm);
+	
+	for(p=0;p<thisATA->peers;p++)
+	{
+		if (p == thisATA->rank) continue;
+		*sent += (double)thisATA->sendCounts[p] * sizeof(realType);
+		if (nodes[p] != node)
+			*offNode += (double)thisATA->sendCounts[p] * sizeof(realType);
+	}
+	
+	free(nodes);
+}
+
+const char *engineName(int engine)
+{ /* For the banner and result line */
+	switch (engine)
+	{
+		case ENGINE_PACK:     return "pack";
+		case ENGINE_DATATYPE: return "datatype";
+		case ENGINE_PERSISTENT: return "persistent";
+		case ENGINE_HIERARCHICAL: return "hierarchical";
+		case ENGINE_SHARED:   return "shared";
+		case ENGINE_RMA:      return "rma";
+		case ENGINE_PAIRWISE: return "pairwise";
+		case ENGINE_BRUCK:    return "bruck";
+		case ENGINE_WINDOWED: return "windowed";
+		default:              return "unknown";
+	}
+}
+
+
+/*********************************
+ * Blocked pack/unpack kernels.  *
+ *********************************/
+
+/* These do the same job as the scalar versions further down, but as loop   *
+ *  nests rather than one pass with the index recovered by division. Every  *
+ *  complexType we support (C99 complex or a two-double struct) can be      *
+ *  copied with plain assignment, so we do that rather than calling         *
+ *  complexAssign for each element.                                         */
+
+static void transposeBlock(complexType *src, int srcStride, complexType *dst, int dstStride,
+                           int rows, int cols)
+{ /* Sets dst[c*dstStride + r] = src[r*srcStride + c] for a rows*cols block,  *
+   *  walking it in PACK_TILE squares so that the lines being read and the    *
+   *  lines being written both stay in cache while a tile is copied.         */
+	int r, c, rr, cc, rEnd, cEnd;
+	
+	for(r=0;r<rows;r+=PACK_TILE)
+	{
+		rEnd = ( r + PACK_TILE < rows ) ? r + PACK_TILE : rows;
+		for(c=0;c<cols;c+=PACK_TILE)
+		{
+			cEnd = ( c + PACK_TILE < cols ) ? c + PACK_TILE : cols;
+			for(cc=c;cc<cEnd;cc++)
+			{
+				for(rr=r;rr<rEnd;rr++)
+				{
+					dst[cc*dstStride + rr] = src[rr*srcStride + cc];
+				}
+			}
+		}
+	}
+}
+
+static void unpackRuns(complexType *dataIn, complexType *dataOut, int rows, int *runLengths,
+                       int *runStarts, int blocks, int extent, int groupRows, int planeRows, 
+                       int firstRow)
+{ /* After the all-to-all, block q holds, for every output row, the runLengths[q] *
+   *  elements that belong at runStarts[q] along that row, so it begins          *
+   *  rows*runStarts[q] elements in. Both unpacks reduce to this, differing only *
+   *  in the runs and the number of rows.                                        *
+   * When only a group of rows was sent (see performPipelinedTranspose), the     *
+   *  incoming rows are groupRows of every planeRows, starting at firstRow.      */
+	int r, q;
+	complexType *out;
+	
+	OMP_FOR(private(q, out))
+	for(r=0;r<rows;r++)
+	{
+		out = dataOut + ( ( r / groupRows ) * planeRows + firstRow + r % groupRows ) * extent;
+		
+		/* Each output row is written from start to end, one run per block. */
+		for(q=0;q<blocks;q++)
+		{
+			if (runLengths[q] == 1)
+			{ /* Runs too short for memcpy to be worth calling */
+				out[runStarts[q]] = dataIn[rows*runStarts[q] + r];
+			} else {
+				memcpy(out + runStarts[q], 
+				       dataIn + rows*runStarts[q] + r*runLengths[q],
+				       runLengths[q] * sizeof(complexType));
+			}
+		}
+	}
+}
+
+void ataRowRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                     ataInfo *thisATA)
+{ /* Blocked equivalent of ataRowRearrangeScalar. For each plane i and target   *
+   *  processor p, the d0*counts[p] tile starting at column starts[p] is        *
+   *  transposed into the p'th send block, which begins d0*d1*starts[p] in.     */
+	int i, j, p, kk;
+	int d0 = domainSize[0];
+	int d1 = domainSize[1];
+	int peers = thisATA->peers;
+	int *counts = thisATA->scatterCounts;
+	int *starts = thisATA->scatterStarts;
+	complexType *in, *out;
+	
+	if ( ( d0 < PACK_TILE ) || ( extent / peers < PACK_TILE ) )
+	{ /* Tiles are smaller than a cache block - stream along the input rows instead. */
+		OMP_FOR(collapse(2) private(p, kk, in, out))
+		for(i=0;i<d1;i++)
+		{
+			for(j=0;j<d0;j++)
+			{
+				in = dataIn + i*d0*extent + j*extent;
+				for(p=0;p<peers;p++)
+				{
+					out = dataOut + d0*d1*starts[p] + i*counts[p]*d0 + j;
+					for(kk=0;kk<counts[p];kk++)
+					{
+						out[kk*d0] = in[starts[p] + kk];
+					}
+				}
+			}
+		}
+	} else {
+		OMP_FOR(collapse(2))
+		for(i=0;i<d1;i++)
+		{
+			for(p=0;p<peers;p++)
+			{
+				transposeBlock(dataIn + i*d0*extent + starts[p], extent,
+				               dataOut + d0*d1*starts[p] + i*counts[p]*d0, d0,
+				               d0, counts[p]);
+			}
+		}
+	}
+}
+
+void ataColRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                     ataInfo *thisATA)
+{ /* Blocked equivalent of ataColRearrangeScalar. */
+	ataColRearrangeGroup(dataIn, dataOut, domainSize, extent, thisATA, 0, domainSize[0]);
+}
+
+void ataColRearrangeGroup(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                          ataInfo *thisATA, int firstRow, int rows)
+{ /* Packs rows firstRow to firstRow+rows-1 of every plane for a column all-to-all. *
+   * For each row j, the d1*extent matrix of (plane, element) is transposed, which *
+   *  lays out every target's block at once since the blocks follow each other    *
+   *  along the element axis - so how it is shared out doesn't come into it.      */
+	int j;
+	int d0 = domainSize[0];
+	int d1 = domainSize[1];
+	
+	OMP_FOR()
+	for(j=0;j<rows;j++)
+	{
+		transposeBlock(dataIn + (firstRow + j)*extent, d0*extent,
+		               dataOut + j*d1, rows*d1,
+		               d1, extent);
+	}
+}
+
+void ataRowUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                  ataInfo *thisATA)
+{ /* Blocked equivalent of ataRowUnpackScalar - contiguous runs of each peer's rows. */
+	int rows = domainSize[1] * thisATA->scatterCounts[thisATA->rank];
+	
+	unpackRuns(dataIn, dataOut, rows, thisATA->gatherCounts, thisATA->gatherStarts,
+	           thisATA->peers, thisATA->gatherExtent, rows, rows, 0);
+}
+
+void ataColUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                  ataInfo *thisATA)
+{ /* Blocked equivalent of ataColUnpackScalar - contiguous runs of each peer's planes. */
+	ataColUnpackGroup(dataIn, dataOut, domainSize, extent, thisATA, 0, domainSize[0]);
+}
+
+void ataColUnpackGroup(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                       ataInfo *thisATA, int firstRow, int rows)
+{ /* Unpacks a column all-to-all of the rows packed by ataColRearrangeGroup */
+	int outRows = rows * thisATA->scatterCounts[thisATA->rank];
+	
+	unpackRuns(dataIn, dataOut, outRows, thisATA->gatherCounts, thisATA->gatherStarts,
+	           thisATA->peers, thisATA->gatherExtent, rows, domainSize[0], firstRow);
+}
+
+void ataUnpackPeer(complexType *block, complexType *dataOut, int domainSize[2], ataInfo *thisATA, int peer)
+{ /* Unpacks the block from one peer, wherever it is, as ataRowUnpack and    *
+   *  ataColUnpack do for each block - it's the same run along every row.   */
+	int r;
+	int rows = ( (thisATA->rearrangeDirection == ROWS) ? domainSize[1] : domainSize[0] ) * 
+	           thisATA->scatterCounts[thisATA->rank];
+	int runLength = thisATA->gatherCounts[peer];
+	complexType *out = dataOut + thisATA->gatherStarts[peer];
+	
+	OMP_FOR()
+	for(r=0;r<rows;r++)
+	{
+		memcpy(out + r*thisATA->gatherExtent, block + r*runLength, runLength * sizeof(complexType));
+	}
+}
+
+
+/*********************************
+ * Scalar pack/unpack kernels.   *
+ *  (The original versions, kept *
+ *   for comparison with -s.)    *
+ *********************************/
+
+void ataRowRearrangeScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                           ataInfo *thisATA)
 { /* Rearranges the data in a domain such that all the data that needs to be *
    *  sent to one processor is contiguous and in the right order, for an     *
    *  all-to-all across rows of a 2D decomposition of a 3D array.            */
-  /* The numbers in comments below refer to domainSize[] = {2,3}, extent=12  */ 
-	int i;
+  /* The numbers in comments below refer to domainSize[] = {2,3}, extent=12, *
+   *  6 peers, so that each peer p gets counts[p]=2 elements of each row.    */ 
+	int i, p;
+	int *counts = thisATA->scatterCounts;
+	int *starts = thisATA->scatterStarts;
 	
+	OMP_FOR(private(p))
 	for(i=0;i<domainSize[0]*domainSize[1]*extent;i++)
 	{
+		p = blockOwner(extent, thisATA->peers, i % extent);
 		complexAssign(&dataOut[
-		                       (  ( i % domainSize[0] ) * domainSize[0] ) + // 0 3 6 every 1
-							   (  ( ( i % extent ) / domainSize[0] ) * domainSize[0] * domainSize[0] * domainSize[1] ) + // 0 18 36 54 every 3
-							   (  ( i / extent ) % domainSize[0] ) + // 0 1 2 every 12
-							   (  ( i / ( domainSize[0] * extent ) ) * domainSize[0] * domainSize[0] ) // 0 9 every 36
+		                       (  ( ( i % extent ) - starts[p] ) * domainSize[0] ) + // 0 2 every 1
+							   (  starts[p] * domainSize[0] * domainSize[1] ) + // 0 12 24 36 48 60 every 2
+							   (  ( i / extent ) % domainSize[0] ) + // 0 1 every 12
+							   (  ( i / ( domainSize[0] * extent ) ) * counts[p] * domainSize[0] ) // 0 4 8 every 24
 							  ]
 							  , dataIn[i]
 							  );
 	}
 }
 
-void ataColRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent)
+void ataColRearrangeScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                           ataInfo *thisATA)
 {
 	int i;
 	
+	OMP_FOR()
 	for(i=0;i<domainSize[0]*domainSize[1]*extent;i++)
 	{
 		
@@ -82,39 +1322,101 @@ void ataColRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2
 	}
 }
 
-
-void ataRowUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent)
-{ /* Unpacks the data after the all-to-all. Performs the same operation as receiving *
-   *  with a vector type would, but allows more flexibility, esp. in the case of the *
-   *  row-wise. */
-	int i;
-	for(i=0;i<domainSize[0]*domainSize[1]*extent;i++)
+static void unpackScalar(complexType *dataIn, complexType *dataOut, int rows, ataInfo *thisATA)
+{ /* Both unpacks come to the same thing. The rows of the result are gatherExtent *
+   *  long, and the block from peer q holds gatherCounts[q] elements of each of   *
+   *  them, from gatherStarts[q] on.                                              */
+	int i, q, m;
+	int length = thisATA->gatherExtent;
+	int elements = rows * length;
+	int *counts = thisATA->gatherCounts;
+	int *starts = thisATA->gatherStarts;
+	
+	OMP_FOR(private(q, m))
+	for(i=0;i<elements;i++)
 	{
+		q = blockOwner(length, thisATA->peers, i / rows);
+		m = i - rows * starts[q]; /* Position within q's block */
 		complexAssign(&dataOut[
-		                      (i%domainSize[0]) + 
-							  ( ((i/domainSize[0]) % (domainSize[0] * domainSize[1])) * extent ) +
-							  ( ( i / (domainSize[0] * domainSize[0] * domainSize[1] )) * domainSize[0] )
+		                      ( m % counts[q] ) + starts[q] + 
+							  ( ( m / counts[q] ) * length )
 		                      ],dataIn[i]
 							  );
 	}
 }
 
-void ataColUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent)
+void ataRowUnpackScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                        ataInfo *thisATA)
+{ /* Unpacks the data after the all-to-all. Performs the same operation as receiving *
+   *  with a vector type would, but allows more flexibility, esp. in the case of the *
+   *  row-wise. The rows of the result are made up of each peer's rows in turn.      */
+	unpackScalar(dataIn, dataOut, domainSize[1] * thisATA->scatterCounts[thisATA->rank], thisATA);
+}
+
+void ataColUnpackScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                        ataInfo *thisATA)
 {
-	int i;
-	for(i=0;i<domainSize[0]*domainSize[1]*extent;i++)
+	unpackScalar(dataIn, dataOut, domainSize[0] * thisATA->scatterCounts[thisATA->rank], thisATA);
+}
+
+static void freeATAdatatypes(ataInfo *thisATA)
+{
+	int p;
+	
+	for(p=0;p<thisATA->peers;p++)
 	{
-		complexAssign(&dataOut[
-							  (i%domainSize[1]) + 
-							  ( ((i/domainSize[1]) % (domainSize[0] * domainSize[1])) * extent ) +
-							  ( ( i / (domainSize[0] * domainSize[1] * domainSize[1] )) * domainSize[1] )
-		                      ],dataIn[i]
-							  );
+		MPI_Type_free(&thisATA->sendTypes[p]);
+		MPI_Type_free(&thisATA->recvTypes[p]);
+	}
+	free(thisATA->sendTypes);
+	free(thisATA->recvTypes);
+	free(thisATA->counts);
+	free(thisATA->sendDispls);
+	free(thisATA->recvDispls);
+	
+	if (thisATA->persistent[0] != MPI_REQUEST_NULL)
+		MPI_Request_free(&thisATA->persistent[0]);
+	if (thisATA->persistent[1] != MPI_REQUEST_NULL)
+		MPI_Request_free(&thisATA->persistent[1]);
+}
+
+static void freeATAlayout(ataInfo *thisATA)
+{
+	free(thisATA->scatterCounts);
+	free(thisATA->scatterStarts);
+	free(thisATA->gatherCounts);
+	free(thisATA->gatherStarts);
+	free(thisATA->sendCounts);
+	free(thisATA->sendOffsets);
+	free(thisATA->recvCounts);
+	free(thisATA->recvOffsets);
+	
+	if (thisATA->groupSendCounts != NULL)
+	{ /* Only made for pipelined transposes */
+		free(thisATA->groupSendCounts);
+		free(thisATA->groupSendOffsets);
+		free(thisATA->groupRecvCounts);
+		free(thisATA->groupRecvOffsets);
 	}
 }
 
 void freeATAcommsHandles(ataInfo *ataRow, ataInfo *ataCol)
 {
+	/* The pipeline buffers are shared, so only freed once. */
+	free(ataRow->stage);
+	free(ataRow->requests);
+	freeATAdatatypes(ataRow);
+	freeATAdatatypes(ataCol);
+	freeHierarchy(ataRow);
+	freeHierarchy(ataCol);
+	freeShared(ataRow);
+	freeShared(ataCol);
+	freeRMA(ataRow);
+	freeRMA(ataCol);
+	freeExchange(ataRow);
+	freeExchange(ataCol);
+	freeATAlayout(ataRow);
+	freeATAlayout(ataCol);
 	MPI_Comm_free(&ataRow->comm);
 	MPI_Comm_free(&ataCol->comm);
 }
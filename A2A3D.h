@@ -16,16 +16,137 @@
 #define ROWS 0
 #define COLS 1
 
+/* Pack/unpack kernel indicator - goes in packMethod */
+#define PACK_BLOCKED 0
+#define PACK_SCALAR  1
+
+/* Side, in elements, of the square tiles the blocked rearranges work in. *
+ *  16 complex doubles is 4 cache lines, so a tile is 4KB either way.     */
+#define PACK_TILE 16
+
+/* Transpose engine indicator - goes in engine */
+#define ENGINE_PACK     0 /* Rearrange, MPI_Alltoall, unpack           */
+#define ENGINE_DATATYPE 1 /* MPI_Alltoallw with derived datatypes       */
+#define ENGINE_PERSISTENT 2 /* As ENGINE_PACK, with a persistent all-to-all */
+#define ENGINE_HIERARCHICAL 3 /* As ENGINE_PACK, with the all-to-all done  *
+                               *  node by node - see prepareATAengine      */
+#define ENGINE_SHARED   4 /* Pack, then unpack straight from the packed   *
+                           *  buffers of the peers on the same node, with *
+                           *  MPI only between nodes                      */
+#define ENGINE_RMA      5 /* Pack, then MPI_Put each block straight into  *
+                           *  its unpacked place at the peer              */
+#define ENGINE_PAIRWISE 6 /* Pack, an all-to-all of our own, unpack -    */
+#define ENGINE_BRUCK    7 /*  by pairwise exchange, by Bruck's method,   */
+#define ENGINE_WINDOWED 8 /*  or window messages at a time - see         *
+                           *  alltoall.c                                 */
+#define ENGINE_COUNT    9
+
+/* Messages ENGINE_WINDOWED keeps in flight each way, unless set with -W */
+#define DEFAULT_ATA_WINDOW 8
+
+/* Set up by prepareATAengine for ENGINE_HIERARCHICAL, ENGINE_SHARED and ENGINE_RMA - see A2A3D.c - *
+ *  and for ENGINE_BRUCK and ENGINE_WINDOWED - see alltoall.c                                       */
+typedef struct ataHierarchy ataHierarchy;
+typedef struct ataShared ataShared;
+typedef struct ataRMA ataRMA;
+typedef struct ataExchange ataExchange;
+
 /* Encapsulated data for All-to-All information */
-typedef struct { MPI_Comm comm; int rearrangeDirection; } ataInfo;
+typedef struct { 
+	MPI_Comm comm; 
+	int peers;              /* Processors in comm */
+	int rank;               /*  and our place in it */
+	int rearrangeDirection; 
+	int packMethod; 
+	int engine;
+	int window;             /* Messages in flight, for ENGINE_WINDOWED */
+	
+	/* Who holds what, set up by makeATAlayout. The FFT axis is shared out *
+	 *  between the peers in blocks, which needn't all be the same size,   *
+	 *  and the new one, gatherExtent long, is gathered from their rows    *
+	 *  (or planes). Counts and starts are in elements along those axes.   */
+	int gatherExtent;
+	int *scatterCounts, *scatterStarts;
+	int *gatherCounts, *gatherStarts;
+	
+	/* All-to-all counts and offsets, in reals, for the whole transpose and   *
+	 *  for one pipeline group. When even, every peer's share is the same     *
+	 *  and plain MPI_Alltoall is used rather than MPI_Alltoallv.             */
+	int even;
+	int *sendCounts, *sendOffsets, *recvCounts, *recvOffsets;
+	int *groupSendCounts, *groupSendOffsets, *groupRecvCounts, *groupRecvOffsets;
+	
+	/* Layouts used by ENGINE_DATATYPE, built once in makeDecomposition, *
+	 *  one pair for each peer.                                          */
+	MPI_Datatype *sendTypes, *recvTypes;
+	int *counts, *sendDispls, *recvDispls;
+	
+	/* Pipelined transposes - number of groups, and the staging buffer and *
+	 *  requests, which the row and column transposes share.               */
+	int pipelineDepth;
+	complexType *stage;
+	MPI_Request *requests;
+	
+	/* Persistent all-to-alls for ENGINE_PERSISTENT, one for each buffer the *
+	 *  data can start in, since they are bound to their buffers.           */
+	MPI_Request persistent[2];
+	
+	/* How ENGINE_HIERARCHICAL gathers, exchanges and scatters, or NULL */
+	ataHierarchy *hierarchy;
+	
+	/* Where ENGINE_SHARED finds the node's packed buffers, or NULL */
+	ataShared *shared;
+	
+	/* The windows and layouts ENGINE_RMA puts through, or NULL */
+	ataRMA *rma;
+	
+	/* What the hand-written all-to-alls need, or NULL */
+	ataExchange *exchange;
+} ataInfo;
 
-int performDistTranspose(complexType *data, complexType *dataBuffer, int domainSize[2], int extent,
+/* Stage argument to performPipelinedTranspose when there are no FFTs on that side */
+#define NO_FFT -1
+
+/* Timings gathered by performPipelinedTranspose, accumulated over calls */
+typedef struct {
+	double fftTime;  /* Spent in the FFTs run inside the pipeline             */
+	double waitTime; /* Spent in MPI posting groups and waiting for them      */
+	double commSpan; /* From posting the first group to the last one arriving */
+} pipelineStats;
+
+void makeATAlayout(ataInfo *thisATA, int domainSize[2], int extent, int gatherExtent);
+int performDistTranspose(complexType *data[2], int live, int domainSize[2], int extent,
                          ataInfo *thisATA);
+void transposedShape(ataInfo *thisATA, int domainSize[2], int extent, 
+                     int outDomain[2], int *outExtent);
+
+int performPipelinedTranspose(complexType *data[2], int live, int domainSize[2], int extent,
+                              ataInfo *thisATA, int fftBefore, int fftAfter, pipelineStats *stats);
+void preparePipeline(ataInfo *ataRow, ataInfo *ataCol, int stageDomain[3][2], int stageExtent[3], 
+                     int depth);
+
+/* All of these take the shape of the data going in - see transposedShape for what comes out. */
+void ataRowRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataColRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataRowUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataColUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataColRearrangeGroup(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                          ataInfo *thisATA, int firstRow, int rows);
+void ataColUnpackGroup(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent,
+                       ataInfo *thisATA, int firstRow, int rows);
+void ataUnpackPeer(complexType *block, complexType *dataOut, int domainSize[2], ataInfo *thisATA, int peer);
+
+void ataRowRearrangeScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataColRearrangeScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataRowUnpackScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
+void ataColUnpackScalar(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent, ataInfo *thisATA);
 
-void ataRowRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent);
-void ataColRearrange(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent);
-void ataRowUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent);
-void ataColUnpack(complexType *dataIn, complexType *dataOut, int domainSize[2], int extent);
+void makeATAdatatypes(ataInfo *thisATA, int domainSize[2], int extent);
+int persistentATAavailable();
+void prepareATAengine(ataInfo *thisATA, complexType *data[2], MPI_Win windows[2], 
+                      int domainSize[2], int extent);
+const char *engineName(int engine);
+void transposeVolume(ataInfo *thisATA, int node, double *sent, double *offNode);
 
 void freeATAcommsHandles(ataInfo *ataRow, ataInfo *ataCol);
 
@@ -0,0 +1,208 @@
+/*
+ *  alltoall.c
+ *  Hand-written all-to-alls, for the transpose engines that choose the
+ *   algorithm themselves rather than leaving it to the MPI library, which
+ *   may switch between its own at the wrong message sizes.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "libDefs.h"
+#include "A2A3D.h"
+#include "alltoall.h"
+
+/* What the hand-written all-to-alls need beyond the counts and offsets. *
+ *  Sizes are in reals, as the counts are.                               */
+struct ataExchange {
+	MPI_Request *requests;  /* ENGINE_WINDOWED's, two for each message in flight    */
+	int blockUnit;          /* A block is this times its source's gatherCounts and  *
+	                         *  its destination's scatterCounts                     */
+	int slotSize;           /* ENGINE_BRUCK's slots, each the size of the largest   */
+	realType *slots;        /*  block, one for each peer                            */
+	realType *outgoing, *incoming; /*  and the blocks forwarded in one step         */
+};
+
+static void *allocExchange(size_t bytes)
+{
+	void *table = malloc(bytes);
+	if ( ( table == NULL ) && ( bytes > 0 ) )
+	{
+		fprintf(stderr, "Unable to alloc all-to-all buffers in routine prepareExchange (alltoall.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	return table;
+}
+
+void alltoallPairwise(realType *send, realType *recv, ataInfo *thisATA)
+{ /* In each of peers-1 steps, every peer sends to the one k after it and     *
+   *  receives from the one k before, so each has one message each way in   *
+   *  flight at a time. Our own block is just copied.                       */
+	int k, to, from;
+	int peers = thisATA->peers;
+	int rank  = thisATA->rank;
+	
+	memcpy(recv + thisATA->recvOffsets[rank], send + thisATA->sendOffsets[rank],
+	       thisATA->sendCounts[rank] * sizeof(realType));
+	
+	for(k=1;k<peers;k++)
+	{
+		to   = (rank + k) % peers;
+		from = (rank - k + peers) % peers;
+		MPI_Sendrecv(send + thisATA->sendOffsets[to], thisATA->sendCounts[to], REAL_MPI_TYPE, to, 0,
+		             recv + thisATA->recvOffsets[from], thisATA->recvCounts[from], REAL_MPI_TYPE, from, 0,
+		             thisATA->comm, MPI_STATUS_IGNORE);
+	}
+}
+
+void alltoallWindowed(realType *send, realType *recv, ataInfo *thisATA)
+{ /* Posts the receives and sends for window peers at a time, in the order   *
+   *  alltoallPairwise takes them, and waits for all of them before the next *
+   *  lot, so that no more than window messages are in flight each way.     */
+	ataExchange *ex = thisATA->exchange;
+	int first, last, k, to, from;
+	int requests;
+	int peers = thisATA->peers;
+	int rank  = thisATA->rank;
+	
+	for(first=0;first<peers;first+=thisATA->window)
+	{
+		last = first + thisATA->window;
+		if (last > peers) last = peers;
+		
+		requests = 0;
+		for(k=first;k<last;k++)
+		{
+			from = (rank - k + peers) % peers;
+			MPI_Irecv(recv + thisATA->recvOffsets[from], thisATA->recvCounts[from], REAL_MPI_TYPE,
+			          from, 0, thisATA->comm, &ex->requests[requests++]);
+		}
+		for(k=first;k<last;k++)
+		{
+			to = (rank + k) % peers;
+			MPI_Isend(send + thisATA->sendOffsets[to], thisATA->sendCounts[to], REAL_MPI_TYPE,
+			          to, 0, thisATA->comm, &ex->requests[requests++]);
+		}
+		MPI_Waitall(requests, ex->requests, MPI_STATUSES_IGNORE);
+	}
+}
+
+static int bruckBlock(ataInfo *thisATA, int source, int dest)
+{ /* The size of the block source sends dest. Every peer can work this out, *
+   *  since the axis the transpose doesn't touch is the same for them all.  */
+	return thisATA->exchange->blockUnit * thisATA->gatherCounts[source] * thisATA->scatterCounts[dest];
+}
+
+void alltoallBruck(realType *send, realType *recv, ataInfo *thisATA)
+{ /* Bruck's all-to-all takes log2(peers) steps. In step k, every peer sends    *
+   *  the peer k after it one message, holding each block whose distance still *
+   *  to go has bit k set. The messages are fewer but larger than the others',  *
+   *  and carry blocks more than once, so it suits small blocks.                *
+   * Blocks are kept in slots by the distance they have to go, which doesn't    *
+   *  change, but which block is in a slot does, so each slot has room for the  *
+   *  largest. Before step k, slot i holds the block from the peer (i & (k-1))  *
+   *  before us, for the peer i after that.                                     */
+	ataExchange *ex = thisATA->exchange;
+	int i, k, source, length;
+	int sent, received;
+	int peers = thisATA->peers;
+	int rank  = thisATA->rank;
+	
+	for(i=0;i<peers;i++)
+	{
+		memcpy(ex->slots + i*ex->slotSize, send + thisATA->sendOffsets[(rank + i) % peers],
+		       thisATA->sendCounts[(rank + i) % peers] * sizeof(realType));
+	}
+	
+	for(k=1;k<peers;k*=2)
+	{
+		/* What goes out has come from (i & (k-1)) back, and what comes in from k further */
+		sent = 0;
+		received = 0;
+		for(i=k;i<peers;i++)
+		{
+			if ( (i & k) == 0 ) continue;
+			source = (rank - (i & (k - 1)) + peers) % peers;
+			length = bruckBlock(thisATA, source, (source + i) % peers);
+			memcpy(ex->outgoing + sent, ex->slots + i*ex->slotSize, length * sizeof(realType));
+			sent += length;
+			
+			source = (source - k + peers) % peers;
+			received += bruckBlock(thisATA, source, (source + i) % peers);
+		}
+		
+		MPI_Sendrecv(ex->outgoing, sent, REAL_MPI_TYPE, (rank + k) % peers, 0,
+		             ex->incoming, received, REAL_MPI_TYPE, (rank - k + peers) % peers, 0,
+		             thisATA->comm, MPI_STATUS_IGNORE);
+		
+		received = 0;
+		for(i=k;i<peers;i++)
+		{
+			if ( (i & k) == 0 ) continue;
+			source = (rank - (i & (k - 1)) - k + 2 * peers) % peers;
+			length = bruckBlock(thisATA, source, (source + i) % peers);
+			memcpy(ex->slots + i*ex->slotSize, ex->incoming + received, length * sizeof(realType));
+			received += length;
+		}
+	}
+	
+	/* Every block has arrived, so slot i holds the one from the peer i before us */
+	for(i=0;i<peers;i++)
+	{
+		source = (rank - i + peers) % peers;
+		memcpy(recv + thisATA->recvOffsets[source], ex->slots + i*ex->slotSize,
+		       thisATA->recvCounts[source] * sizeof(realType));
+	}
+}
+
+void prepareExchange(ataInfo *thisATA, int domainSize[2])
+{ /* Makes the requests ENGINE_WINDOWED keeps in flight, or the slots and step *
+   *  buffers of ENGINE_BRUCK, for a transpose of data shaped as domainSize.   */
+	ataExchange *ex;
+	int p, mostGathered = 0, mostScattered = 0;
+	int peers = thisATA->peers;
+	
+	ex = allocExchange(sizeof(ataExchange));
+	thisATA->exchange = ex;
+	ex->requests = NULL;
+	ex->slots    = NULL;
+	ex->outgoing = NULL;
+	ex->incoming = NULL;
+	
+	if (thisATA->engine == ENGINE_WINDOWED)
+		ex->requests = allocExchange(2 * thisATA->window * sizeof(MPI_Request));
+	
+	if (thisATA->engine == ENGINE_BRUCK)
+	{
+		for(p=0;p<peers;p++)
+		{
+			if (thisATA->gatherCounts[p] > mostGathered)   mostGathered  = thisATA->gatherCounts[p];
+			if (thisATA->scatterCounts[p] > mostScattered) mostScattered = thisATA->scatterCounts[p];
+		}
+		
+		/* Two reals for each point of the untouched axis */
+		ex->blockUnit = 2 * ( (thisATA->rearrangeDirection == ROWS) ? domainSize[1] : domainSize[0] );
+		ex->slotSize  = ex->blockUnit * mostGathered * mostScattered;
+		
+		/* No more than half the slots, rounded up, are forwarded in any one step */
+		ex->slots    = allocExchange((size_t)peers * ex->slotSize * sizeof(realType));
+		ex->outgoing = allocExchange((size_t)( (peers + 1) / 2 ) * ex->slotSize * sizeof(realType));
+		ex->incoming = allocExchange((size_t)( (peers + 1) / 2 ) * ex->slotSize * sizeof(realType));
+	}
+}
+
+void freeExchange(ataInfo *thisATA)
+{
+	ataExchange *ex = thisATA->exchange;
+	
+	if (ex == NULL) return;
+	
+	free(ex->requests);
+	free(ex->slots);
+	free(ex->outgoing);
+	free(ex->incoming);
+	free(ex);
+	thisATA->exchange = NULL;
+}
@@ -0,0 +1,24 @@
+/*
+ *  alltoall.h
+ *  Hand-written all-to-alls, for the transpose engines that choose the
+ *   algorithm themselves rather than leaving it to the MPI library.
+ *
+ */
+
+#ifndef HEADER_ALLTOALL
+#define HEADER_ALLTOALL
+
+#include <mpi.h>
+#include "libDefs.h"
+#include "A2A3D.h"
+
+/* All of these do what the MPI_Alltoallv of transposeByPacking does, *
+ *  from and to buffers laid out by the counts and offsets of thisATA. */
+void alltoallPairwise(realType *send, realType *recv, ataInfo *thisATA);
+void alltoallBruck(realType *send, realType *recv, ataInfo *thisATA);
+void alltoallWindowed(realType *send, realType *recv, ataInfo *thisATA);
+
+void prepareExchange(ataInfo *thisATA, int domainSize[2]);
+void freeExchange(ataInfo *thisATA);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ *  autotune.c
+ *  Choosing the decomposition, processor grid and transpose engine by
+ *   timing each of them. The timing itself is done by main, which knows
+ *   how to set up and run a configuration; this lists the ones there are,
+ *   and keeps the winner in a tuning file for later runs.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include "libDefs.h"
+#include "comms.h"
+#include "A2A3D.h"
+#include "decomposition.h"
+#include "autotune.h"
+
+
+int listTuneConfigs(tuneConfig **configs, int size, int extents[3], int realInput, int roundTrip)
+{ /* Makes a list of every configuration that can run this grid on this many       *
+   *  processors, and returns how many there are. Slabs are tried with and without *
+   *  the 2D FFTs and rods on every grid the processors can be arranged in, each   *
+   *  with every transpose engine, along with the automatic decomposition where    *
+   *  validateParameters would allow it. Every processor makes the same list.     */
+	int count = 0;
+	int kind, rows, engine;
+	int decomp, use2DFFT;
+	int decompDims[2];
+	int stageGlobal[3][2], stageExtent[3];
+	
+	/* Three kinds of decomposition for each grid, each engine, and the automatic one */
+	if ( NULL == ( *configs = malloc( ( 3 * size * ENGINE_COUNT + 1 ) * sizeof(tuneConfig) ) ) )
+	{
+		fprintf(stderr, "Could not allocate autotuning configurations.\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	
+	/* The library does its own transposes here, so there's no engine to choose */
+	if ( ( 1 == libraryHasAutomaticDecomposition() ) &&
+	     ( extents[0] == extents[1] ) && ( extents[0] == extents[2] ) &&
+	     ( extents[2] % size == 0 ) && ( realInput == 0 ) && ( roundTrip == 0 ) )
+	{
+		(*configs)[count].decomp        = 0;
+		(*configs)[count].use2DFFT      = 0;
+		(*configs)[count].engine        = ENGINE_PACK;
+		(*configs)[count].decompDims[0] = 1;
+		(*configs)[count].decompDims[1] = size;
+		count++;
+	}
+	
+	/* As -d takes them - 1 for slab, 2 for rod, 3 for slab with 2D FFTs */
+	for(kind=1;kind<=3;kind++)
+	{
+		decomp   = ( kind == 3 ) ? 1 : kind;
+		use2DFFT = ( kind == 3 ) ? 1 : 0;
+		
+		for(rows=1;rows<=size;rows++)
+		{
+			/* Slabs only ever have the one row of processors */
+			if ( ( size % rows != 0 ) || ( ( decomp == 1 ) && ( rows != 1 ) ) ) continue;
+			
+			decompDims[0] = rows;
+			decompDims[1] = size / rows;
+			makeStageShapes(stageGlobal, stageExtent, extents, decomp, use2DFFT, realInput);
+			if ( !decompositionFits(decompDims, stageGlobal) ) continue;
+			
+			for(engine=0;engine<ENGINE_COUNT;engine++)
+			{
+				if ( ( engine == ENGINE_PERSISTENT ) && ( 0 == persistentATAavailable() ) ) continue;
+				
+				(*configs)[count].decomp        = decomp;
+				(*configs)[count].use2DFFT      = use2DFFT;
+				(*configs)[count].engine        = engine;
+				(*configs)[count].decompDims[0] = decompDims[0];
+				(*configs)[count].decompDims[1] = decompDims[1];
+				count++;
+			}
+		}
+	}
+	
+	return count;
+}
+
+void tuneConfigName(char *name, tuneConfig *config)
+{ /* Describes a configuration, for the output. name needs 64 characters. */
+	if (config->decomp == 0)
+		sprintf(name, "auto");
+	else
+		sprintf(name, "%s %dx%d, %s engine",
+		        ((config->use2DFFT == 1) ? "slab with 2D FFTs" : ((config->decomp == 1) ? "slab" : "rod")),
+		        config->decompDims[0], config->decompDims[1], engineName(config->engine));
+}
+
+/* A tuning file is one line, with the decomposition as -d takes it */
+#define TUNING_FORMAT "decomposition %d grid %dx%d engine %d time %lg\n"
+
+int loadTuning(const char *fileName, tuneConfig *chosen, tuneConfig *configs, int count, MPI_Comm comm)
+{ /* Rank 0 reads the configuration an earlier run chose, if there is a tuning  *
+   *  file, and tells the rest which of configs it is. Returns 0, leaving chosen *
+   *  alone, if there's no file, or it doesn't name one of configs - it may      *
+   *  have been made by a run with different options.                           */
+	int found = -1;
+	int c, kind;
+	int decompDims[2];
+	int engine;
+	double time;
+	FILE *file;
+	
+	if (amMaster(comm))
+	{
+		file = fopen(fileName, "r");
+		if (file != NULL)
+		{
+			if ( 5 == fscanf(file, TUNING_FORMAT, &kind, &decompDims[0], &decompDims[1], &engine, &time) )
+			{
+				for(c=0;c<count;c++)
+				{
+					if ( ( configs[c].decomp == ( ( kind == 3 ) ? 1 : kind ) ) &&
+					     ( configs[c].use2DFFT == ( ( kind == 3 ) ? 1 : 0 ) ) &&
+					     ( configs[c].decompDims[0] == decompDims[0] ) &&
+					     ( configs[c].decompDims[1] == decompDims[1] ) &&
+					     ( ( configs[c].engine == engine ) || ( configs[c].decomp == 0 ) ) )
+						found = c;
+				}
+			}
+			fclose(file);
+			
+			/* Not fatal - it's just tuned again */
+			if (found == -1)
+				fprintf(stderr, "Tuning in %s doesn't fit this run - ignoring it.\n", fileName);
+		}
+	}
+	
+	MPI_Bcast(&found, 1, MPI_INT, 0, comm);
+	if (found == -1) return 0;
+	
+	*chosen = configs[found];
+	return 1;
+}
+
+void saveTuning(const char *fileName, tuneConfig *chosen, double time, MPI_Comm comm)
+{ /* Rank 0 writes the chosen configuration, and how long it took, to fileName. */
+	FILE *file;
+	
+	if (amMaster(comm))
+	{
+		file = fopen(fileName, "w");
+		if (file != NULL)
+		{
+			fprintf(file, TUNING_FORMAT, ((chosen->use2DFFT == 1) ? 3 : chosen->decomp),
+			        chosen->decompDims[0], chosen->decompDims[1], chosen->engine, time);
+			fclose(file);
+		} else {
+			/* Not fatal either - the next run just tunes again */
+			fprintf(stderr, "Tuning could not be written to %s.\n", fileName);
+		}
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ *  autotune.h
+ *  Choosing the decomposition, processor grid and transpose engine by
+ *   timing each of them.
+ *
+ */
+
+#ifndef HEADER_AUTOTUNE
+#define HEADER_AUTOTUNE
+
+#include <mpi.h>
+
+/* Transforms the autotuner times for each configuration, after an untimed one */
+#define TUNE_LOOPS 3
+
+/* One of the ways of running the benchmark that the autotuner chooses between */
+typedef struct {
+	int decomp;        /* 0 for automatic, 1 for slab, 2 for rod */
+	int use2DFFT;      /* 1 for slabs done with the 2D FFTs      */
+	int engine;        /* How the distributed transposes are done */
+	int decompDims[2]; /* Processors along each dimension        */
+} tuneConfig;
+
+int listTuneConfigs(tuneConfig **configs, int size, int extents[3], int realInput, int roundTrip);
+void tuneConfigName(char *name, tuneConfig *config);
+int loadTuning(const char *fileName, tuneConfig *chosen, tuneConfig *configs, int count, MPI_Comm comm);
+void saveTuning(const char *fileName, tuneConfig *chosen, double time, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ *  benchmarkLocalTranspose.c
+ *  Microbenchmark comparing the local transpose implementations.
+ *   Each is run on a single extent*extent slab for extents from 
+ *   32 to 4096, and the effective bandwidth (every element read 
+ *   and written once) is reported for both.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#include "libDefs.h"
+#include "performLocalTranspose.h"
+#include "benchmarkLocalTranspose.h"
+
+#define BENCH_MIN_EXTENT 32
+#define BENCH_MAX_EXTENT 4096
+/* Each measurement is repeated until at least this many elements have been moved */
+#define BENCH_MIN_ELEMENTS (1 << 26)
+
+static double timeTranspose(void (*transpose)(complexType *, int, int), 
+                            complexType *slab, int extent, int repeats)
+{ /* Returns seconds per transpose */
+	int r;
+	double start;
+	
+	transpose(slab, extent, 1); /* Warm up the cache and TLB */
+	start = MPI_Wtime();
+	for(r=0;r<repeats;r++)
+	{
+		transpose(slab, extent, 1);
+	}
+	return (MPI_Wtime() - start) / repeats;
+}
+
+void benchmarkLocalTranspose()
+{
+	int extent, i, repeats, mismatches;
+	long elements;
+	double naiveTime, blockedTime, bytes;
+	complexType *slab, *check;
+	
+	printf("local-transpose-bench:extent,naive GB/s,blocked GB/s,speedup,check\n");
+	
+	for(extent=BENCH_MIN_EXTENT;extent<=BENCH_MAX_EXTENT;extent*=2)
+	{
+		elements = (long)extent * extent;
+		if ( ( NULL == ( slab = malloc( elements * sizeof(complexType) ) ) ) ||
+		     ( NULL == ( check = malloc( elements * sizeof(complexType) ) ) ) )
+		{
+			fprintf(stderr, "Could not allocate a %dx%d slab for the transpose benchmark.\n", 
+			        extent, extent);
+			exit(5);
+		}
+		
+		/* Verify the blocked version against the naive one first */
+		for(i=0;i<elements;i++)
+		{
+			complexSet(&slab[i], i, -i);
+			complexSet(&check[i], i, -i);
+		}
+		performLocalTranspose(slab, extent, 1);
+		performLocalTransposeNaive(check, extent, 1);
+		mismatches = 0;
+		for(i=0;i<elements;i++)
+		{
+			if (complexAbsNorm(slab[i], check[i]) != 0) mismatches++;
+		}
+		
+		repeats = BENCH_MIN_ELEMENTS / elements;
+		if (repeats < 1) repeats = 1;
+		
+		naiveTime   = timeTranspose(performLocalTransposeNaive, slab, extent, repeats);
+		blockedTime = timeTranspose(performLocalTranspose, slab, extent, repeats);
+		
+		/* Each element is read once and written once */
+		bytes = 2.0 * (double) elements * sizeof(complexType);
+		printf("local-transpose-bench:%d,%g,%g,%g,%s\n",
+		       extent,
+		       bytes / naiveTime / 1e9,
+		       bytes / blockedTime / 1e9,
+		       naiveTime / blockedTime,
+		       ((mismatches == 0)?"ok":"MISMATCH"));
+		fflush(stdout);
+		
+		free(slab);
+		free(check);
+	}
+}
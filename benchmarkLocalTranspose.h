@@ -0,0 +1,11 @@
+/*
+ *  benchmarkLocalTranspose.h
+ *  Microbenchmark comparing the local transpose implementations.
+ *
+ */
+#ifndef HEADER_BENCHMARKLOCALTRANSPOSE
+
+void benchmarkLocalTranspose();
+
+#define HEADER_BENCHMARKLOCALTRANSPOSE
+#endif
@@ -8,33 +8,199 @@
 
 # The C code that produces the CSV output.
 << EOF 
-printf("fft-results:%d,%d,%s,%s,%s,%g,%g,%g\n",
+printf("fft-results:%d,%s,%s,%s,%s,%g,%g,%g,%s,%d,%g,%g,%g,%s,%s,%s,%d,%s,%g,%d,%g,%g,%g,%g,%g,%g,%g\n",
 			size,
-			extent,
-			((decompType==1)?"slab":"rod"),
+			sizeName,
+			decompName,
 			((use2DFFT==1)?"2DFFT":"1DFFT"),
 			FFT_NAME,
 			
 			/* Communication/memory reorg time */ 
-			(phaseTime[2] - phaseTime[1]) + 
-			 (phaseTime[4] - phaseTime[3]),
+			reorgTime,
 			
 			/* FFT time */
-			(phaseTime[1] - phaseTime[0]) + 
-			 (phaseTime[3] - phaseTime[2])+
-			 (phaseTime[5] - phaseTime[4]),
+			fftTime,
 			 
 			 /* Total time */
-			phaseTime[5] - phaseTime[0]
+			totalTime,
+			
+			((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+			pipelineDepth,
+			
+			/* Communication not hidden behind FFTs, and the fraction that was */
+			exposedCommTime,
+			hiddenComm,
+			
+			/* From uneven blocks */
+			imbalance,
+			
+			((realInput==1)?"r2c":"c2c"),
+			((roundTrip==1)?"roundtrip":"forward"),
+			PRECISION_NAME,
+			threads,
+			
+			/* How hard, and for how long, the FFTs were planned */
+			plannerEffortName(plannerEffort),
+			planTime,
+			
+			/* Messages in flight, for the windowed all-to-all */
+			((engine == ENGINE_WINDOWED) ? ataWindow : 0),
+			
+			/* The slowest processor's total time, and how far it was over the mean */
+			phaseSpread[phaseCount].max,
+			phaseSpread[phaseCount].imbalance,
+			
+			/* How fast, in GFLOP/s, and for each processor */
+			gflops,
+			gflops / size,
+			
+			/* What each transpose moved between processors, and in GB/s *
+			 *  from each processor and out of each node                 */
+			((transposes > 0) ? bytesSent / transposes : 0),
+			rankBandwidth,
+			linkBandwidth
+			);
+
+printf("fft-phase:%d,%s,%s,%s,%s,%g,%g,%g,%g,%d,%d\n",
+			size,
+			sizeName,
+			decompName,
+			((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+			phaseNames[p],
+			phaseSpread[p].min,
+			phaseSpread[p].mean,
+			phaseSpread[p].max,
+			phaseSpread[p].imbalance,
+			phaseSpread[p].slowestRank,
+			phaseSpread[p].slowestNode
+			);
+
+printf("fft-subphase:%d,%s,%s,%s,%s,%g,%g,%g,%g,%g,%g\n",
+			size,
+			sizeName,
+			decompName,
+			((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+			timerName(p),
+			subphaseSpread[p].min,
+			subphaseSpread[p].mean,
+			subphaseSpread[p].max,
+			subphaseSpread[p].imbalance,
+			subphaseBytes[p],
+			((subphaseSpread[p].mean > 0) ? subphaseBytes[p] / subphaseSpread[p].mean / 1e9 : 0)
+			);
+
+printf("fft-summary:%d,%s,%s,%s,%s,%d,%g,%g,%g,%g,%g,%g,%g\n",
+			size,
+			sizeName,
+			decompName,
+			((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+			((p < phaseCount) ? phaseNames[p] : "total"),
+			spread.count,
+			spread.median,
+			spread.p10,
+			spread.p90,
+			spread.mean,
+			spread.stddev,
+			
+			/* The 95% confidence interval for the mean */
+			spread.mean - spread.confidence,
+			spread.mean + spread.confidence
 			);
 EOF
 
-# So, size, extent, decomp, use2DFFT, lib name, reorg time, fft time, total time
+# So, size, extent, decomp, use2DFFT, lib name, reorg time, fft time, total time,
+#  transpose engine, pipeline depth, exposed comm time, hidden comm fraction,
+#  load imbalance, transform type, direction, precision, threads per process,
+#  planner effort, planning time, messages in flight, slowest total time,
+#  time imbalance, GFLOP/s, GFLOP/s per processor, bytes per transpose,
+#  transpose GB/s per processor, transpose GB/s per node
+# The extent is a single number for a cube, or NXxNYxNZ otherwise.
+# The load imbalance is the most work any processor has over the average,
+#  so 1 when the grid divides evenly.
+# The transform type is r2c for real input, where only half the x modes are
+#  kept and transposed, or c2c.
+# The direction is roundtrip when each forward transform was followed by the
+#  inverse, whose time is then included, or forward.
+# The precision is single or double, chosen when the benchmark was built.
+# Threads per process is 1 unless built with OpenMP.
+# The planner effort is the one the library actually used - fixed when it has
+#  no choice - and the planning time is the longest any processor took, once,
+#  before the repeats, so it's the same on every line of a run.
+# The transpose engines pairwise, bruck and windowed are all-to-alls of our
+#  own, rather than the library's. Messages in flight is how many windowed
+#  keeps going each way at once (-W), and 0 for every other engine.
+# The reorg, FFT and total times are the master's. The slowest total time is the most
+#  any processor took, and the time imbalance that over the mean of them all,
+#  so 1 when they all took as long.
+# The GFLOP/s take the usual 5 N log2 N flops for N points (half that for
+#  r2c, twice for a round trip) over the slowest total time, and are 0 when
+#  FFTs are skipped. Bytes per transpose are what all the processors send
+#  each other in one distributed transpose - none for -d0, where the
+#  library does its own. The transpose bandwidths are what each processor
+#  sends, and what leaves each node, over the slowest processor's time in
+#  the distributed transpose phases - so 0 per node on one node.
+#
+# Before any of them, the master prints an fft-columns line for each kind
+#  of line - results, phase, subphase (with TIMERS=yes) and summary - with
+#  the version of the format, the kind, then the name of each column, so
+#  that the output says what it holds. Times are in seconds, sizes in bytes
+#  and bandwidths in GB/s. The version goes up whenever the columns change.
+#
+# Each result line is followed by an fft-phase line for each phase of the
+#  transform - size, extent, decomp, transpose engine, phase, then that
+#  phase's least, mean and most time over the processors, the most over the
+#  mean, and the rank and node of the processor that took the most. The
+#  phases are fft-x, transpose-1, fft-y, transpose-2 and fft-z, then the
+#  inverse ones, backwards, for a round trip. When the phases overlap (-k)
+#  or the library does them all (-d0), each is timed up to where the next
+#  can be told apart, so some can be 0 - a pipelined transpose counts the
+#  FFTs it overlaps with as part of it.
+#
+# Slab runs from before the fft-phase lines were added counted the last
+#  FFTs as reorganisation time, not FFT time, so their reorg-time and
+#  fft-time columns don't compare with later slab runs.
+#
+# Built with TIMERS=yes, the fft-phase lines are followed by an fft-subphase
+#  line for each step inside them - pack, wire, unpack, local-transpose and
+#  fft - with the same columns, then the mean bytes each processor moved in
+#  that step and the GB/s that makes over the mean time. Pack and unpack
+#  move the whole array, and wire what goes to other processors (for the
+#  datatype engine, the packing is done by MPI and is all wire). The fft
+#  step moves nothing, so its bandwidth is 0. Each is summed over the
+#  transposes of the transform.
+#
+# Transforms warming up (-u) print nothing. With -m, -c or -b, nor do the
+#  timed ones - instead, there's one fft-summary line for each phase, then
+#  the total, at the end: size, extent, decomp, transpose engine, phase,
+#  how many transforms were timed, then the median, 10th and 90th
+#  percentiles, mean and standard deviation of the phase's time on the
+#  slowest processor in each, and the 95% confidence interval for the mean.
+# Runs with -o<file> also append JSON lines to that file, which need no
+#  grepping: a "run" record with the options, library and version, build,
+#  decomposition and hosts, then an "iteration" record for each timed
+#  transform, with the same numbers as its fft-results, fft-phase and
+#  fft-subphase lines, and a "summary" record with -m. They all carry the
+#  format version and the run's ID ("run") - when it began, the master's
+#  host and its process ID - which ties them together. The run record
+#  has when it began on its own as well ("started"). This just gathers
+#  them into one file as well.
+cat $(grep -l '"record":"run"' $@ 2>/dev/null) /dev/null >> all_results.jsonl
+hostname >> all_columns.csv
+grep -h "fft-columns:" $@ | sed 's/fft-columns://' | sort -u >> all_columns.csv
 hostname >> all_data.csv
 grep -h "fft-results:" $@ | sed 's/fft-results://' >> all_data.csv
+hostname >> all_phases.csv
+grep -h "fft-phase:" $@ | sed 's/fft-phase://' >> all_phases.csv
+hostname >> all_subphases.csv
+grep -h "fft-subphase:" $@ | sed 's/fft-subphase://' >> all_subphases.csv
+hostname >> all_summaries.csv
+grep -h "fft-summary:" $@ | sed 's/fft-summary://' >> all_summaries.csv
 
 # Example record
-# 32,64,slab,1DFFT,fftw3,1.5,2.5,6
+# 32,64,slab,1DFFT,fftw3,1.5,2.5,6,pack,0,1.5,0,1,c2c,forward,double,1,measure,0.5,0,6.5,1.1,0.73,0.023,4.1e+06,0.00082,0.0033
+# 32,64,slab,pack,transpose-2,1.2,1.4,1.9,1.35,17,2
+# 32,64,slab,pack,wire,0.8,0.9,1.2,1.33,1.2e+08,0.13
+# 32,64,slab,pack,total,40,6.1,5.9,6.8,6.2,0.35,6.09,6.31
 
 # cat all_data.csv | dbInsert.pl
 
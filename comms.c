@@ -11,6 +11,9 @@
 #include <mpi.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
 
 
 int amMaster(MPI_Comm comm)
@@ -34,10 +37,86 @@ int getSize(MPI_Comm comm)
 
 int commsInit(int *argc, char ***argv)
 {
+#ifdef _OPENMP
+	/* Threads only run the loops between MPI calls, so only the main *
+	 *  thread ever makes them.                                       */
+	int provided;
+	
+	MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+	if (provided < MPI_THREAD_FUNNELED)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "This MPI library can't be used with threads - "
+			                "rebuild with OPENMP=no.\n");
+		commsEnd();
+		exit(2);
+	}
+#else
 	MPI_Init(argc, argv);
+#endif
 	return 0;
 }
 
+int processThreads(int requested)
+{ /* Sets the number of OpenMP threads each process runs, if one was *
+   *  requested, and returns the number it will run - always 1 when  *
+   *  built without OpenMP.                                          */
+#ifdef _OPENMP
+	if (requested > 0)
+		omp_set_num_threads(requested);
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+void nodeInfo(MPI_Comm comm, int *node, int *nodes)
+{ /* Finds which node - set of processors that can share memory - this one is *
+   *  on, numbered from 0 in order of the lowest rank on each, and how many    *
+   *  nodes comm spans.                                                        */
+	MPI_Comm nodeComm;
+	int rank, nodeRank, leader;
+	
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+	MPI_Comm_rank(nodeComm, &nodeRank);
+	
+	/* Each node's lowest rank counts the nodes before its own */
+	leader = ( nodeRank == 0 ) ? 1 : 0;
+	MPI_Exscan(&leader, node, 1, MPI_INT, MPI_SUM, comm);
+	if (rank == 0) *node = 0;
+	MPI_Bcast(node, 1, MPI_INT, 0, nodeComm);
+	MPI_Allreduce(&leader, nodes, 1, MPI_INT, MPI_SUM, comm);
+	
+	MPI_Comm_free(&nodeComm);
+}
+
+void hostInfo(int node, char **names, int **nodes, MPI_Comm comm)
+{ /* Gathers each processor's host name, MPI_MAX_PROCESSOR_NAME characters to a *
+   *  rank, and node - see nodeInfo - to rank 0 of comm, which gets them back to *
+   *  free. The rest get NULLs.                                                  */
+	char name[MPI_MAX_PROCESSOR_NAME] = {0};
+	int length, size;
+	
+	*names = NULL;
+	*nodes = NULL;
+	MPI_Comm_size(comm, &size);
+	if (amMaster(comm))
+	{
+		*names = malloc((size_t)size * MPI_MAX_PROCESSOR_NAME);
+		*nodes = malloc(size * sizeof(int));
+		if ( ( *names == NULL ) || ( *nodes == NULL ) )
+		{
+			fprintf(stderr, "Unable to alloc host names in routine hostInfo (comms.c)\n");
+			MPI_Abort(MPI_COMM_WORLD, 5);
+		}
+	}
+	
+	MPI_Get_processor_name(name, &length);
+	MPI_Gather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, *names, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, comm);
+	MPI_Gather(&node, 1, MPI_INT, *nodes, 1, MPI_INT, 0, comm);
+}
+
 void commSync(MPI_Comm comm)
 {
 	MPI_Barrier(comm);
@@ -49,6 +128,69 @@ void doubleGlobalSum( double *amount, MPI_Comm comm)
         MPI_Allreduce( &amount_copy, amount, 1, MPI_DOUBLE, MPI_SUM, comm );
 }
 
+void doubleGlobalMax( double *amount, MPI_Comm comm)
+{
+        double amount_copy = *amount;
+        MPI_Allreduce( &amount_copy, amount, 1, MPI_DOUBLE, MPI_MAX, comm );
+}
+
+void phaseStatistics(double *times, phaseStats *stats, int count, int node, MPI_Comm comm)
+{ /* Reduces count times, taken on every processor of comm, to their least, mean *
+   *  and most, and finds which processor took the most, and which node it's on. *
+   *  node is this processor's - see nodeInfo. Every processor gets the results.  */
+	struct { double time; int rank; } *local, *slowest;
+	double *least, *sum;
+	int *nodes, *slowestNodes;
+	int i, rank, size;
+	
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+	
+	local        = malloc(count * sizeof(*local));
+	slowest      = malloc(count * sizeof(*slowest));
+	least        = malloc(count * sizeof(double));
+	sum          = malloc(count * sizeof(double));
+	nodes        = malloc(count * sizeof(int));
+	slowestNodes = malloc(count * sizeof(int));
+	if ( ( local == NULL ) || ( slowest == NULL ) || ( least == NULL ) || ( sum == NULL ) || 
+	     ( nodes == NULL ) || ( slowestNodes == NULL ) )
+	{
+		fprintf(stderr, "Unable to alloc phase statistics in routine phaseStatistics (comms.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	
+	for(i=0;i<count;i++)
+	{
+		local[i].time = times[i];
+		local[i].rank = rank;
+	}
+	MPI_Allreduce(times, least, count, MPI_DOUBLE, MPI_MIN, comm);
+	MPI_Allreduce(times, sum, count, MPI_DOUBLE, MPI_SUM, comm);
+	MPI_Allreduce(local, slowest, count, MPI_DOUBLE_INT, MPI_MAXLOC, comm);
+	
+	/* Only the slowest processor knows its node, so the rest put in -1 */
+	for(i=0;i<count;i++)
+		nodes[i] = ( slowest[i].rank == rank ) ? node : -1;
+	MPI_Allreduce(nodes, slowestNodes, count, MPI_INT, MPI_MAX, comm);
+	
+	for(i=0;i<count;i++)
+	{
+		stats[i].min  = least[i];
+		stats[i].mean = sum[i] / size;
+		stats[i].max  = slowest[i].time;
+		stats[i].imbalance   = ( stats[i].mean > 0 ) ? stats[i].max / stats[i].mean : 1;
+		stats[i].slowestRank = slowest[i].rank;
+		stats[i].slowestNode = slowestNodes[i];
+	}
+	
+	free(local);
+	free(slowest);
+	free(least);
+	free(sum);
+	free(nodes);
+	free(slowestNodes);
+}
+
 void commsEnd()
 {
 	MPI_Finalize();
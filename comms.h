@@ -10,11 +10,24 @@
 
 #include <mpi.h>
 
+/* How long one phase took across the processors - see phaseStatistics */
+typedef struct {
+	double min, mean, max;
+	double imbalance;  /* The most over the mean - 1 when every processor took as long */
+	int slowestRank;   /* Which processor took the most, */
+	int slowestNode;   /*  and the node it's on          */
+} phaseStats;
+
 int amMaster(MPI_Comm comm);
 int commsInit(int *argc, char ***argv);
+int processThreads(int requested);
 int getSize(MPI_Comm comm);
+void nodeInfo(MPI_Comm comm, int *node, int *nodes);
+void hostInfo(int node, char **names, int **nodes, MPI_Comm comm);
 void commSync(MPI_Comm comm);
 void doubleGlobalSum( double *amount, MPI_Comm comm);
+void doubleGlobalMax( double *amount, MPI_Comm comm);
+void phaseStatistics(double *times, phaseStats *stats, int count, int node, MPI_Comm comm);
 void commsEnd();
 
 #define HEADER_COMMS
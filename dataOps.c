@@ -13,20 +13,37 @@
 #include "libDefs.h"
 #include "comms.h"
 #include "dataOps.h"
+#include "decomposition.h"
 
 
-void makeDataArrays( complexType *data[2], int extent, int domainSize[2] )
+static long largestStage( int stageExtent[3], int stageDomain[3][2] )
+{ /* The local domain can grow at a transpose when the blocks are uneven, *
+   *  so the arrays have to hold the largest of the stages.               */
+	int s;
+	long elements, largest = 0;
+	
+	for(s=0;s<3;s++)
+	{
+		elements = (long)stageExtent[s] * stageDomain[s][0] * stageDomain[s][1];
+		if (elements > largest) largest = elements;
+	}
+	return largest;
+}
+
+void makeDataArrays( complexType *data[2], int stageExtent[3], int stageDomain[3][2] )
 {
+	long largest = largestStage(stageExtent, stageDomain);
+	
 	/* Allocate storage space, checking for NULLs */
 	/* Avoid this failing -- core dumps break IO handlers */
-	if ( NULL == ( data[0] = malloc( extent * domainSize[0] * domainSize[1] * sizeof(complexType) ) ) )
+	if ( NULL == ( data[0] = malloc( largest * sizeof(complexType) ) ) )
 	{
 		fprintf(stderr, "Could not allocate primary data array.\n");
 		commsEnd();
 		exit(5);
 	}
 	
-	if ( NULL == ( data[1] = malloc( extent * domainSize[0] * domainSize[1] * sizeof(complexType) ) ) )
+	if ( NULL == ( data[1] = malloc( largest * sizeof(complexType) ) ) )
 	{
 		fprintf(stderr, "Could not allocate secondary data array.\n");
 		commsEnd();
@@ -34,28 +51,84 @@ void makeDataArrays( complexType *data[2], int extent, int domainSize[2] )
 	}
 }
 
+void makeSharedDataArrays( complexType *data[2], MPI_Win windows[2], int stageExtent[3], 
+                           int stageDomain[3][2], MPI_Comm comm )
+{ /* As makeDataArrays, but each array is part of a window shared with the other *
+   *  processors of comm on the same node, so that they can read it directly -   *
+   *  see ENGINE_SHARED. Each processor's part is kept apart, on its own pages,  *
+   *  rather than all of them being made one contiguous array.                   *
+   * The windows are left locked, for the processors to synchronise on as they   *
+   *  need to, until cleanUpSharedData.                                          */
+	int b;
+	long largest = largestStage(stageExtent, stageDomain);
+	MPI_Comm nodeComm;
+	MPI_Info info;
+	
+	MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm);
+	MPI_Info_create(&info);
+	MPI_Info_set(info, "alloc_shared_noncontig", "true");
+	
+	for(b=0;b<2;b++)
+	{
+		if ( MPI_SUCCESS != MPI_Win_allocate_shared( largest * sizeof(complexType), sizeof(complexType),
+		                                             info, nodeComm, &data[b], &windows[b] ) )
+		{
+			fprintf(stderr, "Could not allocate shared data array.\n");
+			commsEnd();
+			exit(5);
+		}
+		MPI_Win_lock_all(MPI_MODE_NOCHECK, windows[b]);
+	}
+	
+	MPI_Info_free(&info);
+	MPI_Comm_free(&nodeComm);
+}
 
-void makeData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2] )
-{ /* Fills data array 0 with a trivariate multisine function. This should ideally give *
-   *  a transform output that is easy to verify.  */
+
+static void fillMultisine( complexType *target, int extents[3], int extent, int domainSize[2], 
+                           int decompDims[2], int cartCoords[2], int realInput )
+{ /* Fills target with a trivariate multisine function. This should ideally give      *
+   *  a transform output that is easy to verify. Each axis completes one period, so    *
+   *  the peaks land in the same places whatever shape the grid is.                    *
+   * extent is the length of the stored rows, in complex numbers. With real input,    *
+   *  each row is instead extents[0] reals, padded   with zeroes to fill that space.  */
 	int i,j,k;
-	double ratio = 2.0 * 3.14159265358979323846 / ( (double) extent );
+	realType *row;
+	double xRatio = 2.0 * 3.14159265358979323846 / ( (double) extents[0] );
+	double yRatio = 2.0 * 3.14159265358979323846 / ( (double) extents[1] );
+	double zRatio = 2.0 * 3.14159265358979323846 / ( (double) extents[2] );
+	int firstPlane = blockStart(extents[2], decompDims[1], cartCoords[1]);
+	int firstRow   = blockStart(extents[1], decompDims[0], cartCoords[0]);
 	
 	/* Populate data field */
+	OMP_FOR(collapse(2) private(k, row))
 	for(i=0;i<domainSize[1];i++)
 	{
 		for(j=0;j<domainSize[0];j++)
 		{
-			for(k=0;k<extent;k++)
+			if (realInput == 1)
 			{
-				complexSet( &data[0][ i*domainSize[0]*extent + j*extent + k ],
-							sin(
-							ratio * (i + ( cartCoords[1] * domainSize[1] ) ) +
-							ratio * (j + ( cartCoords[0] * domainSize[0] ) ) + 
-							ratio * k
-							)
-							,
-							0);
+				row = (realType *)&target[ i*domainSize[0]*extent + j*extent ];
+				for(k=0;k<2*extent;k++)
+				{
+					row[k] = ( k < extents[0] ) ? sin(
+					                              zRatio * (i + firstPlane ) +
+					                              yRatio * (j + firstRow ) + 
+					                              xRatio * k
+					                              ) : 0;
+				}
+			} else {
+				for(k=0;k<extent;k++)
+				{
+					complexSet( &target[ i*domainSize[0]*extent + j*extent + k ],
+								sin(
+								zRatio * (i + firstPlane ) +
+								yRatio * (j + firstRow ) + 
+								xRatio * k
+								)
+								,
+								0);
+				}
 			}
 		}
 	}
@@ -64,10 +137,20 @@ void makeData( complexType *data[2], int extent, int domainSize[2], int cartCoor
 	
 }
 
-void makeTestData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2] )
-{ /* Fills data array 0 such that the decomposed cube contains a simple counting up in the real *
-   *  part, and the processor location in the imaginary part. For testing. */
+void makeData( complexType *data[2], int extents[3], int extent, int domainSize[2], int decompDims[2], 
+               int cartCoords[2], int realInput )
+{ /* Fills data array 0 with the input - see fillMultisine. */
+	fillMultisine(data[0], extents, extent, domainSize, decompDims, cartCoords, realInput);
+}
+
+void makeTestData( complexType *data[2], int extents[3], int extent, int domainSize[2], int decompDims[2], 
+                   int cartCoords[2] )
+{ /* Fills data array 0 such that the decomposed grid contains a simple counting up in the real *
+   *  part, and the processor location in the imaginary part. For testing.                     *
+   * extent is the length of the stored rows, which is shorter than the grid with real input.  */
 	int i,j,k;
+	int firstPlane = blockStart(extents[2], decompDims[1], cartCoords[1]);
+	int firstRow   = blockStart(extents[1], decompDims[0], cartCoords[0]);
 		
 	/* Populate data field */
 	for(i=0;i<domainSize[1];i++)
@@ -77,8 +160,8 @@ void makeTestData( complexType *data[2], int extent, int domainSize[2], int cart
 			for(k=0;k<extent;k++)
 			{
 				complexSet( &data[0][ i*domainSize[0]*extent + j*extent + k ],
-							( (i + ( cartCoords[1] * domainSize[1] ) ) * extent * extent )  +
-							( (j + ( cartCoords[0] * domainSize[0] ) ) * extent )  + k,
+							( (i + firstPlane ) * extents[1] * extent )  +
+							( (j + firstRow ) * extent )  + k,
 							cartCoords[0] * 100 + cartCoords[1]);
 			}
 		}
@@ -89,7 +172,7 @@ void makeTestData( complexType *data[2], int extent, int domainSize[2], int cart
 }
 
 
-int printData( complexType *data[2], int extent, int domainSize[2], int decompDims[2], int cartCoords[2] )
+int printData( complexType *data[2], int live, int extent, int domainSize[2], int decompDims[2], int cartCoords[2] )
 { /* Simply prints out the data array in an understandable (though not always clean) format. */
   /* Best for extent<8 */
 	_Complex double z;
@@ -108,7 +191,7 @@ int printData( complexType *data[2], int extent, int domainSize[2], int decompDi
 					{
 						for(k=0;k<extent;k++)
 						{
-							z = complexNative( data[0][ i*domainSize[0]*extent + j*extent + k ] );
+							z = complexNative( data[live][ i*domainSize[0]*extent + j*extent + k ] );
 							printf("%g,%g ", (abs(creal(z))>0.00001)?creal(z):0.0,(abs(cimag(z))>0.00001)?cimag(z):0.0);
 						}
 						printf("\n");
@@ -124,93 +207,157 @@ int printData( complexType *data[2], int extent, int domainSize[2], int decompDi
 	return 1;
 }
 
-int checkData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2], double tolerance, MPI_Comm comm )
+static void setIfLocal(complexType *expected, int plane, int row, int element, 
+                       int extent, int domainSize[2], int firstPlane, int firstRow, double imag)
+{ /* Sets the element at the given global position of the result, if it's on this processor */
+	plane -= firstPlane;
+	row   -= firstRow;
+	
+	if ( ( plane >= 0 ) && ( plane < domainSize[1] ) && ( row >= 0 ) && ( row < domainSize[0] ) )
+		complexSet(expected + plane*domainSize[0]*extent + row*extent + element, 0, imag);
+}
+
+int checkData( complexType *data[2], int live, int extent, int domainSize[2], int globalSize[2],
+               int extents[3], int decompDims[2], int cartCoords[2], int realInput, 
+               double tolerance, MPI_Comm comm )
 { /* Verifies that two peaks are in far corner and one off top near corner of array, *
-   *  and that all other values are equal to zero.                                   */
+   *  and that all other values are equal to zero.                                   *
+   * extent and domainSize are the shape of the result, and globalSize its rows and *
+   *  planes over all processors. It is shared out the same way as the input was,   *
+   *  though along different axes. extents is the size of the whole grid.           *
+   * With real input only the first half of the x modes is kept, which holds the    *
+   *  near peak but not the far one - that's its complex conjugate.                 */
 	int i,j,k;
 	double residue=0;
+	complexType *result   = data[live];     /* The transformed data             */
+	complexType *expected = data[1 - live]; /* The other buffer is free for use */
 	double peaksize;
+	double points;
+	int planes = globalSize[1];
+	int rows   = globalSize[0];
+	int firstPlane = blockStart(planes, decompDims[1], cartCoords[1]);
+	int firstRow   = blockStart(rows, decompDims[0], cartCoords[0]);
 	
-	/* Generate comparison data, first filling comparison array (data[1]) with zeroes... */
+	/* Generate comparison data, first filling comparison array with zeroes... */
+	OMP_FOR(private(j, k))
 	for(i=0;i<domainSize[1];i++)
 	{
 		for(j=0;j<domainSize[0];j++)
 		{
 			for(k=0;k<extent;k++)
 			{
-				complexSet(data[1]+ i*domainSize[0]*extent + j*extent + k, 0, 0);
+				complexSet(expected+ i*domainSize[0]*extent + j*extent + k, 0, 0);
 			}
 		}
 	}
 	
-	/* And then setting the peaks. First we have to find out where element 1,1,1 is, though. */
-	/* The near peak is set to -i * 0.5 * extent^3, the far to i*0.5*extent^3                */
+	/* And then setting the peaks, at element 1,1,1 and the one diagonally opposite it. *
+	 * The near peak is set to -i * 0.5 * points, the far to i*0.5*points.               */
 	/* NB: Cast these all to doubles so that we never need to worry about integer overflow   *
 	 *  mid-multiply.                                                                        */
-	peaksize = 0.5 * (double)extent * (double) extent * (double) extent;
-	if ( domainSize[0] > 1 ) 
+	points = (double)extents[0] * (double)extents[1] * (double)extents[2];
+	peaksize = 0.5 * points;
+	setIfLocal(expected, 1, 1, 1, extent, domainSize, firstPlane, firstRow, -1 * peaksize);
+	if (realInput == 0)
+		setIfLocal(expected, planes - 1, rows - 1, extent - 1, extent, domainSize, firstPlane, firstRow, peaksize);
+	
+	/* Now generate the sum of the absolute differences between the two... */
+	OMP_FOR(private(j, k) reduction(+:residue))
+	for(i=0;i<domainSize[1];i++)
 	{
-		if ( cartCoords[0] == 0 )		
+		for(j=0;j<domainSize[0];j++)
 		{
-			if ( domainSize[1] > 1 ) 
+			for(k=0;k<extent;k++)
 			{
-				if ( cartCoords[1] == 0 )
-				{   /* If it's on processor (0,0), set element 1,1,1. */
-					complexSet(data[1] + domainSize[0]*extent + extent + 1, 0, -1 * peaksize);
-				}
-			} else {
-				if ( cartCoords[1] == 1 )
-				{  /* If it's on processor (0,1), set element 0,1,1 */
-					complexSet(data[1] + extent + 1, 0, -1 * peaksize);
-				}
+				residue += complexAbsNorm(*(expected+ i*domainSize[0]*extent + j*extent + k), 
+				                          *(result+ i*domainSize[0]*extent + j*extent + k));
 			}
 		}
-	} else  if ( cartCoords[0] == 1 ) 
+	}
+	
+	/* Reduce over processors. */
+	doubleGlobalSum(&residue, comm);
+
+	/* Normalise for matrix size. */
+	residue/= points;
+
+	if (amMaster(comm))
+		fprintf(stderr, "Residue = %g\n", residue);
+	
+	/* And then if the residue is outwith acceptable limits, terminate without a result line. */
+	if ( residue < tolerance ) 
 	{
-		if ( domainSize[1] > 1 ) 
-		{
-			if ( cartCoords[1] == 0 )
-			{  /* If it's on processor (1,0), set element 1,0,1 */
-				complexSet(data[1] + domainSize[0]*extent + 1, 0, -1 * peaksize);
-			}
-		} else {
-			if ( cartCoords[1] == 1 )
-			{ /* If it's on processor (1,1), set element 0,0,1 */
-				complexSet(data[1] + 1, 0, -1 * peaksize);
-			}
-		}
+		return 1; 
+	} else {
+		commsEnd();
+		exit(1);
 	}
+}
+
+void scaleData( complexType *data[2], int live, double factor, int extent, int domainSize[2] )
+{ /* Multiplies the live data through by factor. Used after a round trip, to undo *
+   *  the inverse transforms not being normalised.                                */
+	long i;
+	long elements = (long)domainSize[0] * domainSize[1] * extent;
+	_Complex double z;
 	
-	/* And then the far peak */
-	if ( ( cartCoords[0] == extent/domainSize[0] - 1 ) && ( cartCoords[1] == extent / domainSize[1] - 1 ) )
-	{ /* If I'm the bottom right processor */
-		complexSet(data[1] + domainSize[1]*domainSize[0]*extent - 1 , 0, peaksize);
+	OMP_FOR(private(z))
+	for(i=0;i<elements;i++)
+	{
+		z = complexNative( data[live][i] );
+		complexSet( &data[live][i], factor * creal(z), factor * cimag(z) );
 	}
+}
+
+int checkRoundTrip( complexType *data[2], int live, int extents[3], int extent, int domainSize[2],
+                    int decompDims[2], int cartCoords[2], int realInput, 
+                    double tolerance, MPI_Comm comm )
+{ /* Verifies that a forward and inverse transform, scaled, gave back the input. *
+   * extent and domainSize are the shape of the input, which the round trip     *
+   *  leaves the data in. With real input, only the real rows are compared -    *
+   *  the padding at the end of each is left undefined by the inverse.          *
+   * Unlike checkData, the live buffer is left alone, so the next round trip    *
+   *  can start from it.                                                        */
+	int i,j,k;
+	double residue=0;
+	double points;
+	realType *resultRow, *expectedRow;
+	complexType *result   = data[live];     /* The transformed data             */
+	complexType *expected = data[1 - live]; /* The other buffer is free for use */
 	
-	/* Now generate the sum of the absolute differences between the two... */
+	fillMultisine(expected, extents, extent, domainSize, decompDims, cartCoords, realInput);
+	
+	OMP_FOR(private(j, k, resultRow, expectedRow) reduction(+:residue))
 	for(i=0;i<domainSize[1];i++)
 	{
 		for(j=0;j<domainSize[0];j++)
 		{
-			for(k=0;k<extent;k++)
+			if (realInput == 1)
 			{
-				residue += complexAbsNorm(*(data[1]+ i*domainSize[0]*extent + j*extent + k), 
-				                          *(data[0]+ i*domainSize[0]*extent + j*extent + k));
+				resultRow   = (realType *)(result + i*domainSize[0]*extent + j*extent);
+				expectedRow = (realType *)(expected + i*domainSize[0]*extent + j*extent);
+				for(k=0;k<extents[0];k++)
+				{
+					residue += fabs(expectedRow[k] - resultRow[k]);
+				}
+			} else {
+				for(k=0;k<extent;k++)
+				{
+					residue += complexAbsNorm(*(expected+ i*domainSize[0]*extent + j*extent + k), 
+					                          *(result+ i*domainSize[0]*extent + j*extent + k));
+				}
 			}
 		}
 	}
 	
-	/* Reduce over processors. */
+	/* Reduce over processors, and normalise for matrix size. */
 	doubleGlobalSum(&residue, comm);
-
-	/* Normalise for matrix size. */
-	/* Cast to doubles as before to eliminate problems with integer overflow mid-multiply. */
-	residue/= (double) extent * (double) extent * (double) extent;
-
+	points = (double)extents[0] * (double)extents[1] * (double)extents[2];
+	residue/= points;
+	
 	if (amMaster(comm))
-		fprintf(stderr, "Residue = %g\n", residue);
+		fprintf(stderr, "Round trip residue = %g\n", residue);
 	
-	/* And then if the residue is outwith acceptable limits, terminate without a result line. */
 	if ( residue < tolerance ) 
 	{
 		return 1; 
@@ -225,3 +372,14 @@ void cleanUpData(complexType *data[2])
 	free(data[0]);
 	free(data[1]);
 }
+
+void cleanUpSharedData(MPI_Win windows[2])
+{ /* Frees the arrays made by makeSharedDataArrays - collective over its comm. */
+	int b;
+	
+	for(b=0;b<2;b++)
+	{
+		MPI_Win_unlock_all(windows[b]);
+		MPI_Win_free(&windows[b]);
+	}
+}
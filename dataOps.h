@@ -9,12 +9,23 @@
 #include "libDefs.h"
 #ifndef HEADER_DATAOPS
 
-void makeDataArrays( complexType *data[2], int extent, int domainSize[2] );
-int printData( complexType *data[2], int extent, int domainSize[2], int decompDims[2], int cartCoords[2] );
-int checkData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2], double tolerance, MPI_Comm comm );
-void makeData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2] );
-void makeTestData( complexType *data[2], int extent, int domainSize[2], int cartCoords[2] );
+void makeDataArrays( complexType *data[2], int stageExtent[3], int stageDomain[3][2] );
+void makeSharedDataArrays( complexType *data[2], MPI_Win windows[2], int stageExtent[3], 
+                           int stageDomain[3][2], MPI_Comm comm );
+int printData( complexType *data[2], int live, int extent, int domainSize[2], int decompDims[2], int cartCoords[2] );
+int checkData( complexType *data[2], int live, int extent, int domainSize[2], int globalSize[2],
+               int extents[3], int decompDims[2], int cartCoords[2], int realInput, 
+               double tolerance, MPI_Comm comm );
+void makeData( complexType *data[2], int extents[3], int extent, int domainSize[2], int decompDims[2], 
+               int cartCoords[2], int realInput );
+void makeTestData( complexType *data[2], int extents[3], int extent, int domainSize[2], int decompDims[2], 
+                   int cartCoords[2] );
+void scaleData( complexType *data[2], int live, double factor, int extent, int domainSize[2] );
+int checkRoundTrip( complexType *data[2], int live, int extents[3], int extent, int domainSize[2],
+                    int decompDims[2], int cartCoords[2], int realInput, 
+                    double tolerance, MPI_Comm comm );
 void cleanUpData(complexType *data[2]);
+void cleanUpSharedData(MPI_Win windows[2]);
 
 #define HEADER_DATAOPS
 #endif
\ No newline at end of file
@@ -16,13 +16,32 @@
 #include "A2A3D.h"
 
 
-/* Set up domain sizes, processor arrangements, and column and row communicators. */
-void makeDecomposition(int decompDims[2], int domainSize[2], int extent, int decomp, 
-					  int size, int cartCoords[2], ataInfo *rowInfo, ataInfo *colInfo, MPI_Comm *commAll)
+/* Set up domain sizes, processor arrangements, and column and row communicators.   *
+ * The local domain changes shape at each transpose unless the grid is a cube, so  *
+ *  the shape before each of the three sets of FFTs is worked out here: the rows   *
+ *  and planes of the whole grid in stageGlobal, this processor's share of them in *
+ *  stageDomain, and the length of the axis being transformed in stageExtent. The  *
+ *  final stage is the shape of the result.                                        *
+ * With real input, the x rows are stored as their nx/2+1 complex modes from the  *
+ *  first FFTs on, since the rest are their complex conjugates - so that is the    *
+ *  length that the transposes move.                                               *
+ * The rows and planes are shared out as blocks which needn't be equal - see       *
+ *  blockSize.                                                                     *
+ * A rod decomposition uses the grid already in decompDims if it has one, or the   *
+ *  squarest that divide2Ddomain can make if decompDims[0] is 0.                   *
+ * With nodeAware set, the processors are placed so that each row of the grid -    *
+ *  rowInfo's communicator - is within a node, where the nodes hold whole rows.    *
+ *  Otherwise it's left to MPI_Cart_create.                                        */
+void makeDecomposition(int decompDims[2], int stageGlobal[3][2], int stageDomain[3][2], 
+                       int stageExtent[3], int extents[3], int decomp, int use2DFFT, 
+                       int realInput, int size, int cartCoords[2], ataInfo *rowInfo, ataInfo *colInfo, 
+                       MPI_Comm *commAll, int nodeAware)
 {	
 	int cartRank;
+	int s;
 	int periodicity[2] = {0,0};
-	MPI_Comm tempComm;
+	int node, nodes, place;
+	MPI_Comm tempComm, nodeOrder;
 	
 	/* Work out size of domain */
 	if ((decomp == 1)||(decomp==0))
@@ -30,32 +49,51 @@ void makeDecomposition(int decompDims[2], int domainSize[2], int extent, int dec
 		decompDims[0] = 1;
 		decompDims[1] = size;
 	} else 
-	if (decomp == 2)
+	if ( (decomp == 2) && (decompDims[0] <= 0) )
 	{
 		divide2Ddomain(decompDims, size);
 	};
-
-	domainSize[0] = extent / decompDims[0];
-	domainSize[1] = extent / decompDims[1];
 	
-	/* Check for a valid decomposition */
-	if ( ( domainSize[0] * decompDims[0] != extent ) || 
-	     ( domainSize[1] * decompDims[1] != extent ) )
+	makeStageShapes(stageGlobal, stageExtent, extents, decomp, use2DFFT, realInput);
+	
+	if ( !decompositionFits(decompDims, stageGlobal) )
 	{ 
 		if (amMaster(MPI_COMM_WORLD))
-			fprintf(stderr, "Invalid decomposition obtained - check parameters.\n");
+			fprintf(stderr, "Invalid decomposition obtained - check parameters.\n"
+			                " Each axis must be at least as long as the number of processors it is spread over.\n");
 		MPI_Finalize();
 		exit(6);
 	}
 
 	/* The creation of a cartesian communicator seems a little gratuitous  *
 	 *  but it allows us generalisation. */
-	MPI_Cart_create ( *commAll, 2, decompDims, periodicity, 1, &tempComm );
-	*commAll = tempComm;
+	if (nodeAware == 1)
+	{ /* Line the processors up node by node, and give each row of the grid *
+	   *  the next decompDims[0] of them. Then renumber them in Cartesian   *
+	   *  order for the places they got.                                    */
+		nodeInfo(*commAll, &node, &nodes);
+		MPI_Comm_rank(*commAll, &place);
+		MPI_Comm_split(*commAll, 0, node * size + place, &nodeOrder);
+		MPI_Comm_rank(nodeOrder, &place);
+		MPI_Comm_split(nodeOrder, 0, (place % decompDims[0]) * decompDims[1] + place / decompDims[0], &tempComm);
+		MPI_Comm_free(&nodeOrder);
+		
+		MPI_Cart_create ( tempComm, 2, decompDims, periodicity, 0, commAll );
+		MPI_Comm_free(&tempComm);
+	} else {
+		MPI_Cart_create ( *commAll, 2, decompDims, periodicity, 1, &tempComm );
+		*commAll = tempComm;
+	}
 
 	/* Get this processor's position in the grid */
 	MPI_Comm_rank(*commAll, &cartRank);
 	MPI_Cart_coords(*commAll, cartRank, 2, cartCoords);
+	
+	for(s=0;s<3;s++)
+	{
+		stageDomain[s][0] = blockSize(stageGlobal[s][0], decompDims[0], cartCoords[0]);
+		stageDomain[s][1] = blockSize(stageGlobal[s][1], decompDims[1], cartCoords[1]);
+	}
 
 	/* Make the column and row communicators for the 2D case */
 	/*	int MPI_Comm_split(MPI_Comm comm, int color, int key,
@@ -66,18 +104,124 @@ void makeDecomposition(int decompDims[2], int domainSize[2], int extent, int dec
 	rowInfo->rearrangeDirection = ROWS;
 	colInfo->rearrangeDirection = COLS;
 	
+	/* Who sends what to whom in each transpose, and the layouts for the *
+	 *  derived datatype transpose engine. A row transpose gathers the   *
+	 *  rows of the first stage and a column one the planes of the       *
+	 *  second, even on the paths that don't use them.                   */
+	makeATAlayout(rowInfo, stageDomain[0], stageExtent[0], stageGlobal[0][0]);
+	makeATAlayout(colInfo, stageDomain[1], stageExtent[1], stageGlobal[1][1]);
+	makeATAdatatypes(rowInfo, stageDomain[0], stageExtent[0]);
+	makeATAdatatypes(colInfo, stageDomain[1], stageExtent[1]);
+	
+	return;
+}
+
+int rowsWithinNodes(ataInfo *rowInfo, MPI_Comm commAll, int *nodes)
+{ /* How many rows of the grid - rowInfo's communicators - are all on one node, *
+   *  and how many nodes there are, for the output.                            */
+	int node, lowest, highest, within;
+	
+	nodeInfo(commAll, &node, nodes);
+	MPI_Allreduce(&node, &lowest, 1, MPI_INT, MPI_MIN, rowInfo->comm);
+	MPI_Allreduce(&node, &highest, 1, MPI_INT, MPI_MAX, rowInfo->comm);
+	
+	/* Counted once for each row, by its first processor */
+	within = ( ( lowest == highest ) && ( rowInfo->rank == 0 ) ) ? 1 : 0;
+	MPI_Allreduce(MPI_IN_PLACE, &within, 1, MPI_INT, MPI_SUM, commAll);
+	return within;
+}
+
+/* Works out the shape of the whole grid before each set of FFTs - see *
+ *  makeDecomposition.                                                */
+void makeStageShapes(int stageGlobal[3][2], int stageExtent[3], int extents[3], int decomp, 
+                     int use2DFFT, int realInput)
+{
+	/* x is transformed first, along rows of y, in planes of z. */
+	stageExtent[0]    = ( realInput == 1 ) ? ( extents[0] / 2 + 1 ) : extents[0];
+	stageGlobal[0][0] = extents[1];
+	stageGlobal[0][1] = extents[2];
+	
+	/* A row transpose (or, for slabs, the local transpose - the same thing with *
+	 *  one processor) brings y into the rows, then the column transpose brings  *
+	 *  in z. The 2D FFT and automatic paths have no middle transpose, and we    *
+	 *  assume the library leaves the automatic one's result in place.          */
+	if ( ( decomp == 0 ) || ( use2DFFT == 1 ) )
+	{
+		stageExtent[1]    = stageExtent[0];
+		stageGlobal[1][0] = stageGlobal[0][0];
+		stageGlobal[1][1] = stageGlobal[0][1];
+	} else {
+		stageExtent[1]    = stageGlobal[0][0];
+		stageGlobal[1][0] = stageExtent[0];
+		stageGlobal[1][1] = stageGlobal[0][1];
+	}
+	
+	if ( decomp == 0 )
+	{
+		stageExtent[2]    = stageExtent[1];
+		stageGlobal[2][0] = stageGlobal[1][0];
+		stageGlobal[2][1] = stageGlobal[1][1];
+	} else {
+		stageExtent[2]    = stageGlobal[1][1];
+		stageGlobal[2][0] = stageGlobal[1][0];
+		stageGlobal[2][1] = stageExtent[1];
+	}
+}
+
+int decompositionFits(int decompDims[2], int stageGlobal[3][2])
+{ /* Whether every processor gets a share of each axis, at every stage */
+	int s;
+	int valid = 1;
+	
+	for(s=0;s<3;s++)
+	{
+		valid = valid && ( stageGlobal[s][0] >= decompDims[0] ) && ( stageGlobal[s][1] >= decompDims[1] );
+	}
+	return valid;
+}
+
+/* Sets up the transposes that undo the row and column ones made by makeDecomposition. *
+ * A transpose swaps the FFT axis with the rows (or planes), so doing it again on the  *
+ *  shape it left behind puts the data back - the inverse of the column transpose is   *
+ *  a column transpose of the last stage, and that of the row transpose one of the    *
+ *  middle stage. The slab path's local transpose is undone the same way, in main.    *
+ * The communicators are duplicated so that they can be freed along with the rest.   */
+void makeInverseDecomposition(int stageGlobal[3][2], int stageDomain[3][2], int stageExtent[3], 
+                              ataInfo *rowInfo, ataInfo *colInfo, 
+                              ataInfo *rowBackInfo, ataInfo *colBackInfo)
+{
+	MPI_Comm_dup(rowInfo->comm, &(rowBackInfo->comm));
+	MPI_Comm_dup(colInfo->comm, &(colBackInfo->comm));
+	
+	rowBackInfo->rearrangeDirection = ROWS;
+	colBackInfo->rearrangeDirection = COLS;
+	
+	makeATAlayout(rowBackInfo, stageDomain[1], stageExtent[1], stageGlobal[1][0]);
+	makeATAlayout(colBackInfo, stageDomain[2], stageExtent[2], stageGlobal[2][1]);
+	makeATAdatatypes(rowBackInfo, stageDomain[1], stageExtent[1]);
+	makeATAdatatypes(colBackInfo, stageDomain[2], stageExtent[2]);
+	
+	/* The inverse is never pipelined */
+	rowBackInfo->pipelineDepth = 0;
+	colBackInfo->pipelineDepth = 0;
+	rowBackInfo->stage = NULL;
+	rowBackInfo->requests = NULL;
+	colBackInfo->stage = NULL;
+	colBackInfo->requests = NULL;
+	
 	return;
 }
 
 void divide2Ddomain(int dimensions[2], int processors)
-{ /* This divides up an processor count into two dimensions *
-   *  and puts the result into dimensions. */
+{ /* This divides up an processor count into two dimensions, *
+   *  as near square as it can, and puts the result into     *
+   *  dimensions. A prime count gives a 1 x processors grid. */
 	int i;
 	for(i = (int) sqrt( (double) processors);
 		i>0;
 		i--)
 	{
-		if ( (0 == i%2) && ( 0 == processors%i ) )
+		if ( 0 == processors%i )
 		{
 			dimensions[0] = i;
 			dimensions[1] = processors/i;
@@ -88,3 +232,53 @@ void divide2Ddomain(int dimensions[2], int processors)
 					" No decomposition could be made.\n", processors);
 	exit(6);
 }
+
+/* An axis of n points is shared between parts processors in blocks, as FFTW *
+ *  does with local_n0 - the first n % parts processors get one point more   *
+ *  than the rest.                                                           */
+
+int blockSize(int n, int parts, int part)
+{ /* Points held by processor part */
+	return n / parts + ( ( part < n % parts ) ? 1 : 0 );
+}
+
+int blockStart(int n, int parts, int part)
+{ /* Index of processor part's first point */
+	return part * ( n / parts ) + ( ( part < n % parts ) ? part : n % parts );
+}
+
+int blockOwner(int n, int parts, int index)
+{ /* Which processor holds the given point */
+	int base = n / parts;
+	int rem  = n % parts;
+	
+	if ( index < rem * ( base + 1 ) )
+		return index / ( base + 1 );
+	return rem + ( index - rem * ( base + 1 ) ) / base;
+}
+
+double loadImbalance(int stageDomain[3][2], int stageExtent[3], MPI_Comm comm)
+{ /* How much more work the busiest processor has than the average, in the *
+   *  worst of the three stages - 1 when the blocks are all equal.         *
+   * The totals are summed rather than taken from the grid size, since     *
+   *  the stages hold fewer points than that with real input.              */
+	int s, size;
+	double local[3], largest[3], total[3];
+	double mean, worst = 1;
+	
+	MPI_Comm_size(comm, &size);
+	for(s=0;s<3;s++)
+	{
+		local[s] = (double)stageDomain[s][0] * (double)stageDomain[s][1] * (double)stageExtent[s];
+	}
+	MPI_Allreduce(local, largest, 3, MPI_DOUBLE, MPI_MAX, comm);
+	MPI_Allreduce(local, total, 3, MPI_DOUBLE, MPI_SUM, comm);
+	
+	for(s=0;s<3;s++)
+	{
+		mean = total[s] / (double)size;
+		if ( largest[s] / mean > worst )
+			worst = largest[s] / mean;
+	}
+	return worst;
+}
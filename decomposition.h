@@ -13,10 +13,24 @@
 #include "A2A3D.h"
 
 /* ataInfo struct defined in A2A3D.h */
-void makeDecomposition(int decompDims[2], int domainSize[2], int extent, int decomp, 
-					  int size, int cartCoords[2], ataInfo *rowInfo, ataInfo *colInfo, MPI_Comm *commAll);
+void makeDecomposition(int decompDims[2], int stageGlobal[3][2], int stageDomain[3][2], 
+                       int stageExtent[3], int extents[3], int decomp, int use2DFFT, 
+                       int realInput, int size, int cartCoords[2], ataInfo *rowInfo, ataInfo *colInfo, 
+                       MPI_Comm *commAll, int nodeAware);
 					  				  					  
+void makeInverseDecomposition(int stageGlobal[3][2], int stageDomain[3][2], int stageExtent[3], 
+                              ataInfo *rowInfo, ataInfo *colInfo, 
+                              ataInfo *rowBackInfo, ataInfo *colBackInfo);
+void makeStageShapes(int stageGlobal[3][2], int stageExtent[3], int extents[3], int decomp, 
+                     int use2DFFT, int realInput);
+int decompositionFits(int decompDims[2], int stageGlobal[3][2]);
+int rowsWithinNodes(ataInfo *rowInfo, MPI_Comm commAll, int *nodes);
 void divide2Ddomain(int dimensions[2], int processors);
 
+int blockSize(int n, int parts, int part);
+int blockStart(int n, int parts, int part);
+int blockOwner(int n, int parts, int index);
+double loadImbalance(int stageDomain[3][2], int stageExtent[3], MPI_Comm comm);
+
 #define HEADER_DECOMPOSITION
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+ *  jsonOutput.c
+ *  Writing the results as JSON lines, one object to a line, for -o. What
+ *   goes in each record is up to main - this just keeps the syntax right.
+ *   Only the master writes.
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "jsonOutput.h"
+
+static void writeText(FILE *file, const char *text)
+{ /* As a JSON string, quoted, with whatever JSON can't hold as it is escaped */
+	const char *c;
+	
+	fputc('"', file);
+	for(c=text;*c!='\0';c++)
+	{
+		if ( ( *c == '"' ) || ( *c == '\\' ) )
+			fprintf(file, "\\%c", *c);
+		else if ( (unsigned char)*c < 0x20 )
+			fprintf(file, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+static void writeKey(jsonWriter *json, const char *key)
+{ /* Starts a member of whatever is open, with its name if it's in an object */
+	if (!json->empty) fputc(',', json->file);
+	json->empty = 0;
+	
+	if (key != NULL)
+	{
+		writeText(json->file, key);
+		fputc(':', json->file);
+	}
+}
+
+void jsonBeginRecord(jsonWriter *json, FILE *file)
+{
+	json->file  = file;
+	json->empty = 1;
+	fputc('{', file);
+}
+
+void jsonEndRecord(jsonWriter *json)
+{ /* Flushed, so that a run that's killed leaves every record it finished */
+	fputs("}\n", json->file);
+	fflush(json->file);
+}
+
+void jsonOpenObject(jsonWriter *json, const char *key)
+{
+	writeKey(json, key);
+	fputc('{', json->file);
+	json->empty = 1;
+}
+
+void jsonCloseObject(jsonWriter *json)
+{
+	fputc('}', json->file);
+	json->empty = 0;
+}
+
+void jsonOpenArray(jsonWriter *json, const char *key)
+{
+	writeKey(json, key);
+	fputc('[', json->file);
+	json->empty = 1;
+}
+
+void jsonCloseArray(jsonWriter *json)
+{
+	fputc(']', json->file);
+	json->empty = 0;
+}
+
+void jsonString(jsonWriter *json, const char *key, const char *value)
+{ /* A NULL value is written as null */
+	writeKey(json, key);
+	if (value == NULL)
+		fputs("null", json->file);
+	else
+		writeText(json->file, value);
+}
+
+void jsonInt(jsonWriter *json, const char *key, int value)
+{
+	writeKey(json, key);
+	fprintf(json->file, "%d", value);
+}
+
+void jsonDouble(jsonWriter *json, const char *key, double value)
+{ /* JSON has no infinities or NaNs, so they're written as null */
+	writeKey(json, key);
+	if (isfinite(value))
+		fprintf(json->file, "%.10g", value);
+	else
+		fputs("null", json->file);
+}
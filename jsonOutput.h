@@ -0,0 +1,30 @@
+/*
+ *  jsonOutput.h
+ *  Writing the results as JSON lines, one object to a line, for -o.
+ *
+ */
+
+#ifndef HEADER_JSONOUTPUT
+#define HEADER_JSONOUTPUT
+
+#include <stdio.h>
+
+/* Where a record is being written, and whether anything is in the object *
+ *  or array open in it yet, for the commas.                              */
+typedef struct {
+	FILE *file;
+	int empty;
+} jsonWriter;
+
+/* key is the member's name inside an object, and NULL inside an array */
+void jsonBeginRecord(jsonWriter *json, FILE *file);
+void jsonEndRecord(jsonWriter *json);
+void jsonOpenObject(jsonWriter *json, const char *key);
+void jsonCloseObject(jsonWriter *json);
+void jsonOpenArray(jsonWriter *json, const char *key);
+void jsonCloseArray(jsonWriter *json);
+void jsonString(jsonWriter *json, const char *key, const char *value);
+void jsonInt(jsonWriter *json, const char *key, int value);
+void jsonDouble(jsonWriter *json, const char *key, double value);
+
+#endif
@@ -6,7 +6,8 @@
  *   planning and execution, and would also contain the definition of
  *   the appropriate MPI type to represent the complex number, except
  *   that I decided to assume they were all just two MPI_DOUBLEs.
- *   (Bit compatability can be verified.) 
+ *   (Bit compatability can be verified.) In single precision they are
+ *   two MPI_FLOATs, and the library calls are the single precision ones.
  *
  *  Created by Ian Kirker on 14/04/2008.
  *
@@ -18,27 +19,191 @@
 #include <string.h>
 
 #include "libDefs.h"
+#include "comms.h"
+#include "decomposition.h" /* For blockSize and blockStart */
+#include "timers.h"
 
-/* File scope plan variables - used in prepareFFTs and performFFTs */
+/* File scope plan variables - used in prepareFFTs and performFFTs.   *
+ * There is a 1D plan for each of the three FFT stages, since the axes *
+ *  needn't be the same length.                                        */
 #ifdef FFT_fftw2
-	oneDplanType oneDplan;
+	oneDplanType oneDplan[3];
 	twoDplanType twoDplan;
+	rfftwnd_plan realPlan; /* Replaces oneDplan[0] with real input */
+	oneDplanType oneDbackPlan[3];
+	twoDplanType twoDbackPlan;
+	rfftwnd_plan realBackPlan;
+	#ifdef HAS_AUTO
+		parallelPlanType autoPlan;
+	#endif
+#elif defined(FFT_fftw3)
+	/* FFTW3 plans are tied to the arrays they were made for, so we keep *
+	 *  a 1D plan for each of the two data buffers.                      */
+	planType oneDplan[3][2];
+	planType twoDplan;
+	planType batchPlan[3][2];
+	planType backPlan[3][2];
+	planType twoDbackPlan;
 	#ifdef HAS_AUTO
 		parallelPlanType autoPlan;
 	#endif
 #else
-	planType oneDplan;
+	planType oneDplan[3];
 	planType twoDplan;
+	planType batchPlan[3];
+	planType backPlan[3];  /* MKL only needs these for real input */
+	planType twoDbackPlan;
 	#ifdef HAS_AUTO
 		parallelPlanType autoPlan;
 	#endif
 #endif
 
-void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int domainSize[2], MPI_Comm commColumn)
-{ /* Prepares plans for the FFTs */
+/* Which stage's plans each stage uses - stages with the same shape share them, *
+ *  so a cube only needs one set. A stage that owns its plans points at itself. */
+int planIndex[3] = {0, 1, 2};
+
+/* Pencils per batch for performFFTbatch in each stage, or 0 if it hasn't been prepared. */
+int batchPencils[3] = {0, 0, 0};
+
+/* Length of the real rows the first stage (or the 2D FFTs) transforms, or 0 for complex  *
+ *  input. Those transforms are in place, each row of reals padded out to the extent of   *
+ *  complex modes it becomes, so they never share their plans with the other stages.      */
+int realLength = 0;
+
+/* Whether prepareInverseFFTs has made the backward plans */
+int inversePrepared = 0;
+
+/* OpenMP threads to run the FFTs across in each process - see prepareFFTthreads */
+int fftThreads = 1;
+
+/* How hard the planners look for fast plans - see setPlannerEffort */
+#if defined(FFT_fftw3) || defined(FFT_fftw2)
+	int plannerFlags = FFTW_MEASURE;
+#endif
+#ifdef FFT_acml
+	int planMode = 100; /* Times the possible plans, rather than taking the default */
+#endif
+
+/* Wisdom, as text, for loadWisdom and saveWisdom. Each FFTW frees its own strings. */
+#ifdef FFT_fftw3
+	#define FFTW_WISDOM_EXPORT()   FFTW(export_wisdom_to_string)()
+	#define FFTW_WISDOM_IMPORT(w)  FFTW(import_wisdom_from_string)(w)
+	#define FFTW_WISDOM_FREE(w)    free(w)
+#endif
+#ifdef FFT_fftw2
+	#define FFTW_WISDOM_EXPORT()   fftw_export_wisdom_to_string()
+	#define FFTW_WISDOM_IMPORT(w)  fftw_import_wisdom_from_string(w)
+	#define FFTW_WISDOM_FREE(w)    fftw_free(w)
+#endif
+
+#ifdef FFT_fftw2
+	/* Every FFTW2 plan is made in place, and kept as wisdom for saveWisdom */
+	#define FFTW2_PLAN_FLAGS ( plannerFlags | FFTW_IN_PLACE | FFTW_USE_WISDOM )
+	
+	/* FFTW2's multi-dimensional plans, which its real 1D plans are too, keep *
+	 *  a work array that threads can't share unless told to plan for it.     */
+	#ifdef _OPENMP
+		#define FFTW2_THREAD_FLAGS FFTW_THREADSAFE
+	#else
+		#define FFTW2_THREAD_FLAGS 0
+	#endif
+#endif
+
+void prepareFFTthreads(int threads)
+{ /* Sets how many threads the FFTs run across. Must come before any planning. *
+   * FFTW3 and MKL thread each transform themselves. FFTW2's sets of FFTs are  *
+   *  shared out between OpenMP threads here instead, which saves linking its  *
+   *  threads library. ACML and ESSL are left to their SMP builds (acml_mp,    *
+   *  esslsmp), which take their thread count from OMP_NUM_THREADS.            */
+	fftThreads = threads;
+	
+	#ifdef _OPENMP
+		#ifdef FFT_fftw3
+			FFTW(init_threads)();
+			FFTW(plan_with_nthreads)(threads);
+		#endif
+		
+		#ifdef FFT_mkl
+			mkl_set_num_threads(threads);
+		#endif
+	#endif
+}
+
+int setPlannerEffort(int effort)
+{ /* Sets how hard the planning in prepareFFTs and friends looks for fast plans, *
+   *  and returns the effort this library will actually make, since not all    *
+   *  of them have every level - or any. Must come before any planning.        */
+	#ifdef FFT_fftw3
+		switch (effort)
+		{
+			case PLAN_ESTIMATE:   plannerFlags = FFTW_ESTIMATE;   break;
+			case PLAN_PATIENT:    plannerFlags = FFTW_PATIENT;    break;
+			case PLAN_EXHAUSTIVE: plannerFlags = FFTW_EXHAUSTIVE; break;
+			case PLAN_MEASURE:
+			default:              plannerFlags = FFTW_MEASURE;    break;
+		}
+		return effort;
+	#endif
+	
+	#ifdef FFT_fftw2
+		/* FFTW2 only estimates or measures */
+		plannerFlags = ( effort == PLAN_ESTIMATE ) ? FFTW_ESTIMATE : FFTW_MEASURE;
+		return ( effort == PLAN_ESTIMATE ) ? PLAN_ESTIMATE : PLAN_MEASURE;
+	#endif
+	
+	#ifdef FFT_acml
+		/* Mode 0 takes the default plan, 100 times the alternatives */
+		planMode = ( effort == PLAN_ESTIMATE ) ? 0 : 100;
+		return ( effort == PLAN_ESTIMATE ) ? PLAN_ESTIMATE : PLAN_MEASURE;
+	#endif
+	
+	#ifdef FFT_mkl
+		return PLAN_FIXED;
+	#endif
+	
+	#ifdef FFT_essl
+		return PLAN_FIXED;
+	#endif
+}
+
+const char *plannerEffortName(int effort)
+{ /* For the options, the banner and the results line */
+	switch (effort)
+	{
+		case PLAN_ESTIMATE:   return "estimate";
+		case PLAN_MEASURE:    return "measure";
+		case PLAN_PATIENT:    return "patient";
+		case PLAN_EXHAUSTIVE: return "exhaustive";
+		case PLAN_FIXED:      return "fixed";
+		default:              return "unknown";
+	}
+}
+
+void prepareFFTs(complexType *buffers[2], int decomp, int use2DFFT, int realInput, int extents[3],
+                 int stageExtent[3], int stageDomain[3][2], MPI_Comm commColumn)
+{ /* Prepares plans for the FFTs. stageExtent and stageDomain give the shape of *
+   *  the data before each of the three sets of 1D FFTs (see makeDecomposition), *
+   *  and extents the size of the whole grid along x, y and z.                   */
+	/* Plans for libraries that don't bind to an array are made against buffer 0. */
+	complexType *data = buffers[0];
+	int s, t;
+	
+	realLength = ( realInput == 1 ) ? extents[0] : 0;
+	
+	for(s=0;s<3;s++)
+	{
+		planIndex[s] = s;
+		for(t=s-1;t>=0;t--)
+		{
+			if ( ( t == 0 ) && ( realLength > 0 ) ) continue;
+			if ( ( stageExtent[t] == stageExtent[s] ) && ( stageDomain[t][0] == stageDomain[s][0] ) )
+				planIndex[s] = planIndex[t];
+		}
+	}
 
 	#ifdef FFT_fftw3
 		int n0,n1,n2,alloc,local_n0,n_start;
+		int b;
 		/* For the FFTW versions, we use single FFT plans and repeat them many times. We
 		 *  could also use the fftw_plan_many_dft version.
 		 */
@@ -50,29 +215,46 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 										 fftw_complex *out, const int *onembed, 
                                          int ostride, int odist, 
                                          int sign, unsigned flags); */
-			oneDplan = fftw_plan_many_dft( 1, &extent, domainSize[0]*domainSize[1], 
-			                               data, NULL, 1, extent, data, NULL, 1, 
-										   extent, FFTW_FORWARD, FFTW_MEASURE );
+			for(s=0;s<3;s++)
+			{
+				if (planIndex[s] != s) continue;
+				for(b=0;b<2;b++)
+				{
+					if ( ( s == 0 ) && ( realLength > 0 ) )
+					{ /* Distances are in reals going in, and in complex numbers coming out. */
+						oneDplan[s][b] = FFTW(plan_many_dft_r2c)( 1, &realLength, stageDomain[s][0]*stageDomain[s][1], 
+						                                         (realType *)buffers[b], NULL, 1, 2*stageExtent[s], 
+						                                         buffers[b], NULL, 1, stageExtent[s], plannerFlags );
+					} else {
+						oneDplan[s][b] = FFTW(plan_many_dft)( 1, &stageExtent[s], stageDomain[s][0]*stageDomain[s][1], 
+						                                     buffers[b], NULL, 1, stageExtent[s], buffers[b], NULL, 1, 
+						                                     stageExtent[s], FFTW_FORWARD, plannerFlags );
+					}
+				}
+			}
 		}
 		
 		if (use2DFFT == 1)
 		{ /* We only need this when we're doing a slab decomp with the 2d FFT. */
 			/* Uses same plan on many sequences */
-			twoDplan = fftw_plan_dft_2d( extent, extent, data, data, FFTW_FORWARD, FFTW_MEASURE );
+			if (realLength > 0)
+				twoDplan = FFTW(plan_dft_r2c_2d)( stageDomain[0][0], realLength, (realType *)data, data, plannerFlags );
+			else
+				twoDplan = FFTW(plan_dft_2d)( stageDomain[0][0], stageExtent[0], data, data, FFTW_FORWARD, plannerFlags );
 		}
 		
 		#ifdef HAS_AUTO
 		if (decomp == 0)
 		{
 			/* 3D MPI FFT only in alpha version. */
-			fftw_mpi_init();
+			FFTW(mpi_init)();
 			/* extern fftw_plan fftw_mpi_plan_dft_3d (ptrdiff_t n0, 
 			      ptrdiff_t n1, ptrdiff_t n2, fftw_complex *in, fftw_complex *out, 
 				  MPI_Comm comm, int sign, unsigned flags);
 			 */
-			autoPlan = fftw_mpi_plan_dft_3d ( extent, extent,
-			                                  extent, data, data, commColumn, 
-							                  FFTW_FORWARD, FFTW_MEASURE );
+			autoPlan = FFTW(mpi_plan_dft_3d) ( extents[2], extents[1],
+			                                  extents[0], data, data, commColumn, 
+							                  FFTW_FORWARD, plannerFlags );
 
 		}
 		#endif
@@ -82,44 +264,79 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 		if (decomp != 0)
 		{ /* We only *don't* need this when we're doing an automatic parallel call */
 			/* Unlike FFTW3, you need to specifiy in-place here */
-			oneDplan = fftw_create_plan( extent, FFTW_FORWARD, FFTW_MEASURE | FFTW_IN_PLACE);
+			for(s=0;s<3;s++)
+			{
+				if (planIndex[s] != s) continue;
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+					realPlan = rfftwnd_create_plan( 1, &realLength, FFTW_REAL_TO_COMPLEX, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS );
+				else
+					oneDplan[s] = fftw_create_plan( stageExtent[s], FFTW_FORWARD, FFTW2_PLAN_FLAGS);
+			}
 		}
 		
 		if (use2DFFT == 1)
 		{ /* We only need this when we're doing a slab decomp. */
-			twoDplan = fftw2d_create_plan(extent, extent, FFTW_FORWARD, FFTW_MEASURE | FFTW_IN_PLACE);
+			if (realLength > 0)
+				twoDplan = rfftw2d_create_plan(stageDomain[0][0], realLength, FFTW_REAL_TO_COMPLEX, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS);
+			else
+				twoDplan = fftw2d_create_plan(stageDomain[0][0], stageExtent[0], FFTW_FORWARD, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS);
 		}
 		
 		#ifdef HAS_AUTO
 			if (decomp == 0)
 			{ /* We only need this when we're doing the automatic parallel FFT */
 			  /* All MPI transforms are in-place. */
-				autoPlan = fftw3d_mpi_create_plan(commColumn, extent, extent, extent,
-                                              FFTW_FORWARD, FFTW_MEASURE);
+				autoPlan = fftw3d_mpi_create_plan(commColumn, extents[2], extents[1], extents[0],
+                                              FFTW_FORWARD, plannerFlags);
 			}
 		#endif
 	#endif
 
 	#ifdef FFT_mkl
 		long status;
-		long twoDdims[2] = { extent,extent };
-		long autoDims[3] = { extent,extent,extent };
+		long twoDdims[2] = { stageDomain[0][0], stageExtent[0] };
+		long autoDims[3] = { extents[2], extents[1], extents[0] };
+		long realDims[2] = { stageDomain[0][0], extents[0] };
+		/* Strides for the real 2D FFT - in reals going in, in complex numbers coming out */
+		long realInStrides[3]  = { 0, 2*stageExtent[0], 1 };
+		long realOutStrides[3] = { 0, stageExtent[0], 1 };
 		
 		/* 1D */
 		if (decomp != 0)
 		{
-			status = DftiCreateDescriptor( &oneDplan, DFTI_DOUBLE, DFTI_COMPLEX, 1, extent ); 
-			status = DftiSetValue( oneDplan, DFTI_NUMBER_OF_TRANSFORMS, domainSize[0]*domainSize[1] ); 
-			status = DftiSetValue( oneDplan, DFTI_INPUT_DISTANCE, extent ); 
-			status = DftiSetValue( oneDplan, DFTI_OUTPUT_DISTANCE, extent ); 
-			status = DftiCommitDescriptor( oneDplan );
+			for(s=0;s<3;s++)
+			{
+				if (planIndex[s] != s) continue;
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+				{
+					status = DftiCreateDescriptor( &oneDplan[s], mklPrecision, DFTI_REAL, 1, realLength ); 
+					status = DftiSetValue( oneDplan[s], DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX ); 
+					status = DftiSetValue( oneDplan[s], DFTI_PACKED_FORMAT, DFTI_CCE_FORMAT ); 
+					status = DftiSetValue( oneDplan[s], DFTI_INPUT_DISTANCE, 2*stageExtent[s] ); 
+				} else {
+					status = DftiCreateDescriptor( &oneDplan[s], mklPrecision, DFTI_COMPLEX, 1, stageExtent[s] ); 
+					status = DftiSetValue( oneDplan[s], DFTI_INPUT_DISTANCE, stageExtent[s] ); 
+				}
+				status = DftiSetValue( oneDplan[s], DFTI_NUMBER_OF_TRANSFORMS, stageDomain[s][0]*stageDomain[s][1] ); 
+				status = DftiSetValue( oneDplan[s], DFTI_OUTPUT_DISTANCE, stageExtent[s] ); 
+				status = DftiCommitDescriptor( oneDplan[s] );
+			}
 		}
 		
 		/* 2D */
 		if (use2DFFT == 1)
 		{
-			status = DftiCreateDescriptor( &twoDplan, DFTI_DOUBLE, DFTI_COMPLEX, 2, twoDdims );
-			status = DftiSetValue( twoDplan, DFTI_TRANSPOSE, DFTI_ALLOW );
+			if (realLength > 0)
+			{
+				status = DftiCreateDescriptor( &twoDplan, mklPrecision, DFTI_REAL, 2, realDims );
+				status = DftiSetValue( twoDplan, DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX );
+				status = DftiSetValue( twoDplan, DFTI_PACKED_FORMAT, DFTI_CCE_FORMAT );
+				status = DftiSetValue( twoDplan, DFTI_INPUT_STRIDES, realInStrides );
+				status = DftiSetValue( twoDplan, DFTI_OUTPUT_STRIDES, realOutStrides );
+			} else {
+				status = DftiCreateDescriptor( &twoDplan, mklPrecision, DFTI_COMPLEX, 2, twoDdims );
+				status = DftiSetValue( twoDplan, DFTI_TRANSPOSE, DFTI_ALLOW );
+			}
 			status = DftiCommitDescriptor( twoDplan );
 		}
 		
@@ -127,7 +344,7 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 		#ifdef HAS_AUTO
 		if (decomp == 0)
 		{
-			status = DftiCreateDescriptorDM(commColumn, &autoPlan, DFTI_DOUBLE, DFTI_COMPLEX, 3, autoDims );
+			status = DftiCreateDescriptorDM(commColumn, &autoPlan, mklPrecision, DFTI_COMPLEX, 3, autoDims );
 			status = DftiCommitDescriptorDM( autoPlan );
 		}
 		#endif
@@ -139,7 +356,10 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 		 */
 		int err;
 		
-		oneDplan = malloc( ( (extent * 5) + 100 ) * sizeof(complexType) );
+		for(s=0;s<3;s++)
+		{
+			if (planIndex[s] != s) continue;
+			oneDplan[s] = malloc( ( (stageExtent[s] * 5) + 100 ) * sizeof(complexType) );
 		
 		/* The C prototype isn't in the manual, so I copy it here for helpfulness. */
 		/* See also page 39 of the ACML User Guide */
@@ -148,12 +368,14 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 								int incx1, int incx2, doublecomplex *y, 
 								int incy1, int incy2, doublecomplex *comm, 
 								int *info);*/
-		zfft1mx( 100, (double)1.0, 1, domainSize[0]*domainSize[1],
-		         extent, data, 1, extent, NULL, 1, extent, oneDplan, &err);
+			acmlFft1mx( planMode, (double)1.0, 1, stageDomain[s][0]*stageDomain[s][1],
+			         stageExtent[s], data, 1, stageExtent[s], NULL, 1, stageExtent[s], oneDplan[s], &err);
+		}
 		
 		if (use2DFFT == 1)
 		{
-			 twoDplan = malloc( ( (extent * extent) + (extent * 10) + 200 ) * sizeof(complexType) );
+			 twoDplan = malloc( ( (stageExtent[0] * stageDomain[0][0]) + 
+			                      ((stageExtent[0] + stageDomain[0][0]) * 5) + 200 ) * sizeof(complexType) );
 			
 			/*
 			 * extern void zfft2dx(int mode, double scale, int ltrans, 
@@ -162,7 +384,8 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 			 *                     int incy1, int incy2, doublecomplex *comm, int *info);
 			 */
 
-			zfft2dx( 100, 1.0, 0, 1, extent, extent, data, 1, extent, data, 1, extent, twoDplan, &err );
+			acmlFft2dx( planMode, 1.0, 0, 1, stageExtent[0], stageDomain[0][0], data, 1, stageExtent[0], 
+			         data, 1, stageExtent[0], twoDplan, &err );
 		}
 	#endif
 
@@ -187,34 +410,38 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
                    int, int, double, double *, int, double *, int) */
 		
 	
-		dcft( 1,               /* Is this a planning call only? */
-		      data,            /* Pointer to data in */
-		      1,               /* Stride between elements */
-			  extent,          /* Stride between sequences */
-			  data,            /* Output target */
-			  1,               /* Stride between elements */
-			  extent,          /* Stride between sequences */
-			  extent,          /* Length of sequences */
-			  domainSize[0]*domainSize[1], /* Number of sequences */
-			  +1,              /* Forward or backward? +/- */
-			  (double)1.0,     /* Scale factor for output */
-			  oneDplan,        /* Planning storage */
-			  sizeof(oneDplan)/sizeof(double), /* Size of planning storage */
-			  NULL,          /* Working area for calculation */
-			  0					/* Size of working area */
-			  );
+		for(s=0;s<3;s++)
+		{
+			if (planIndex[s] != s) continue;
+			esslCft( 1,               /* Is this a planning call only? */
+			      data,            /* Pointer to data in */
+			      1,               /* Stride between elements */
+				  stageExtent[s],  /* Stride between sequences */
+				  data,            /* Output target */
+				  1,               /* Stride between elements */
+				  stageExtent[s],  /* Stride between sequences */
+				  stageExtent[s],  /* Length of sequences */
+				  stageDomain[s][0]*stageDomain[s][1], /* Number of sequences */
+				  +1,              /* Forward or backward? +/- */
+				  (double)1.0,     /* Scale factor for output */
+				  oneDplan[s],     /* Planning storage */
+				  sizeof(oneDplan[s])/sizeof(double), /* Size of planning storage */
+				  NULL,          /* Working area for calculation */
+				  0					/* Size of working area */
+				  );
+		}
 			  
 		if (use2DFFT == 1)
 		{
-			dcft2( 1,			/* Planning call */
+			esslCft2( 1,			/* Planning call */
 				data,            /* Pointer to data in */
 				1,               /* Stride between elements in first dimension */
-				extent,          /* Stride between elements in second dimension */
+				stageExtent[0],  /* Stride between elements in second dimension */
 				data,            /* Output target */
 				1,               /* Stride between elements in first dimension */
-				extent,          /* Stride between elements in second dimension */
-				extent,          /* Length in the first dimension */
-				extent,			 /* Length in the second dimension */
+				stageExtent[0],  /* Stride between elements in second dimension */
+				stageExtent[0],  /* Length in the first dimension */
+				stageDomain[0][0], /* Length in the second dimension */
 				+1,              /* Forward or backward? +/- */
 				1.0,               /* Scale factor for output */
 				twoDplan,        /* Planning storage */
@@ -271,12 +498,18 @@ void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int do
 }
 
 
-void performFFTset(complexType *data, complexType *buffer, int extent, int domainSize[2])
-{ /* Performs a domain's worth of 1D FFTs */
+int performFFTset(complexType *buffers[2], int live, int stage, int extent, int domainSize[2])
+{ /* Performs a domain's worth of 1D FFTs on the live buffer, in place,    *
+   *  for the given stage, which has the shape given by extent/domainSize. *
+   *  The other buffer may be used as working space.                       *
+   *  Returns the index of the buffer holding the result.                  */
 	int i;
+	int plan = planIndex[stage];
+	
+	TIMER_START(TIMER_FFT);
 
 	#ifdef FFT_fftw3
-		fftw_execute( oneDplan );
+		FFTW(execute)( oneDplan[plan][live] );
 	#endif
 
 	#ifdef FFT_fftw2
@@ -289,17 +522,36 @@ void performFFTset(complexType *data, complexType *buffer, int extent, int domai
 		/*void fftw(fftw_plan plan, int howmany,
           fftw_complex *in, int istride, int idist,
           fftw_complex *out, int ostride, int odist);*/
-		fftw( oneDplan, domainSize[0]*domainSize[1],
-		      data, 1, extent, buffer, 1, extent );
+		complexType *data   = buffers[live];
+		complexType *buffer = buffers[1 - live];
+		int t, first, count;
+		
+		/* The pencils are shared out between the threads in blocks, each *
+		 *  using its own part of the other buffer as scratch space.      */
+		OMP_FOR(private(first, count))
+		for(t=0;t<fftThreads;t++)
+		{
+			first = blockStart(domainSize[0]*domainSize[1], fftThreads, t);
+			count = blockSize(domainSize[0]*domainSize[1], fftThreads, t);
+			if ( ( stage == 0 ) && ( realLength > 0 ) )
+			{ /* Real transforms in place take no scratch space, and their idist is in reals. */
+				rfftwnd_real_to_complex( realPlan, count,
+				                         (fftw_real *)(data + first*extent), 1, 2*extent, NULL, 1, extent );
+			} else {
+				fftw( oneDplan[plan], count,
+				      data + first*extent, 1, extent, buffer + first*extent, 1, extent );
+			}
+		}
 	#endif
 
 
 	#ifdef FFT_mkl
-		DftiComputeForward( oneDplan, data );
+		DftiComputeForward( oneDplan[plan], buffers[live] );
 	#endif
 
 
 	#ifdef FFT_acml
+		complexType *data = buffers[live];
 		int err;
 		/* Page 39 of the ACML User Guide */
 		/* extern void zfft1mx(int mode, double scale, int inpl, 
@@ -307,11 +559,12 @@ void performFFTset(complexType *data, complexType *buffer, int extent, int domai
 								int incx1, int incx2, doublecomplex *y, 
 								int incy1, int incy2, doublecomplex *comm, 
 								int *info);*/
-		zfft1mx( -1, (double)1.0, 1, domainSize[0]*domainSize[1],
-		         extent, data, 1, extent, NULL, 1, extent, oneDplan, &err);
+		acmlFft1mx( -1, (double)1.0, 1, domainSize[0]*domainSize[1],
+		         extent, data, 1, extent, NULL, 1, extent, oneDplan[plan], &err);
 	#endif
 
 	#ifdef FFT_essl
+		complexType *data = buffers[live];
 		int workingSize;
 		
 		if ( domainSize[0]*domainSize[1]*extent*2 > 20000 )
@@ -323,7 +576,7 @@ void performFFTset(complexType *data, complexType *buffer, int extent, int domai
 			workingSize = 0;
 		}
 
-		dcft( 0,               /* Is this a planning call only? */
+		esslCft( 0,               /* Is this a planning call only? */
 		      data,            /* Pointer to data in */
 			  1,               /* Stride between elements */
 			  extent,          /* Stride between sequences */
@@ -334,41 +587,58 @@ void performFFTset(complexType *data, complexType *buffer, int extent, int domai
 			  domainSize[0]*domainSize[1], /* Number of sequences */
 			  +1,              /* Forward or backward? +/- */
 			  (double)1.0,               /* Scale factor for output */
-			  oneDplan,        /* Planning storage */
-			  sizeof(oneDplan)/sizeof(double), /* Size of planning storage */
+			  oneDplan[plan],  /* Planning storage */
+			  sizeof(oneDplan[plan])/sizeof(double), /* Size of planning storage */
 			  NULL, /*(double*)(void*)buffer,*/          /* Working area for calculation */
 			  0 /*workingSize*/		/* Size of working area */
 			  );
 	#endif
+
+	TIMER_STOP(TIMER_FFT, 0);
+	return live;
 }
 
-void perform2DFFT(complexType *data, complexType *buffer, int extent, int domainSize[2])
-{ /* Performs a slab domain's worth of 2D FFTs */
+int perform2DFFT(complexType *buffers[2], int live, int extent, int domainSize[2])
+{ /* Performs a slab domain's worth of 2D FFTs on the live buffer, in place. *
+   *  Each slab is domainSize[0] rows of extent.                              *
+   *  Returns the index of the buffer holding the result.                    */
 	int i;
+	int slab = domainSize[0] * extent;
 	int workingSize;
+	complexType *data = buffers[live];
+	
+	TIMER_START(TIMER_FFT);
 	
 	#ifdef FFT_fftw3
 		for(i=0;i<domainSize[1];i++)
 		{
 			/* From the 'Guru' interface - consider using fftw_plan_many_dft instead */
 			/* void fftw_execute_dft( const fftw_plan p, fftw_complex *in, fftw_complex *out); */
-			fftw_execute_dft( twoDplan, data + i*extent*extent, data + i*extent*extent );
+			if (realLength > 0)
+				FFTW(execute_dft_r2c)( twoDplan, (realType *)(data + i*slab), data + i*slab );
+			else
+				FFTW(execute_dft)( twoDplan, data + i*slab, data + i*slab );
 		}
 	#endif
 
 	#ifdef FFT_fftw2
+		/* The slabs are shared out between threads - see FFTW2_THREAD_FLAGS */
+		OMP_FOR()
 		for(i=0;i<domainSize[1];i++)
 		{
 			/*void fftwnd_one(fftwnd_plan p, fftw_complex *in, 
 				fftw_complex *out); */
-			fftwnd_one(twoDplan, data + i*extent*extent, data + i*extent*extent);
+			if (realLength > 0)
+				rfftwnd_one_real_to_complex(twoDplan, (fftw_real *)(data + i*slab), NULL);
+			else
+				fftwnd_one(twoDplan, data + i*slab, data + i*slab);
 		}
 	#endif
 
 	#ifdef FFT_mkl
 		for(i=0;i<domainSize[1];i++)
 		{
-			DftiComputeForward( twoDplan, data + i*extent*extent );
+			DftiComputeForward( twoDplan, data + i*slab );
 		}
 	#endif
 
@@ -379,13 +649,15 @@ void perform2DFFT(complexType *data, complexType *buffer, int extent, int domain
 		{
 			/* Initial argument (mode) = -1 means forward FFT w/ precalculated plan.
 			 * See prepareFFTs for full prototype */
- 			zfft2dx( -1, (double)1.0, 0, 1, extent, extent, 
-			        data + i*extent*extent, 1, extent, 
-					data + i*extent*extent, 1, extent, twoDplan, &err );
+ 			acmlFft2dx( -1, (double)1.0, 0, 1, extent, domainSize[0], 
+			        data + i*slab, 1, extent, 
+					data + i*slab, 1, extent, twoDplan, &err );
 		}
 	#endif
 
 	#ifdef FFT_essl
+		complexType *buffer = buffers[1 - live];
+		
 		if ( extent > 251 )
 		{
 			if ( (domainSize[0] * domainSize[1] * extent * 2) > (20000 + (2*extent + 256) * (64+2.28)) )
@@ -406,15 +678,15 @@ void perform2DFFT(complexType *data, complexType *buffer, int extent, int domain
 		
 		for(i=0;i<domainSize[1];i++)
 		{		
-			dcft2( 0,			/* Planning call */
-				data + i*extent*extent,  /* Pointer to data in */
+			esslCft2( 0,			/* Planning call */
+				data + i*slab,  /* Pointer to data in */
 				1,               /* Stride between elements in first dimension */
 				extent,          /* Stride between elements in second dimension */
-				data + i*extent*extent,  /* Output target */
+				data + i*slab,  /* Output target */
 				1,               /* Stride between elements in first dimension */
 				extent,          /* Stride between elements in second dimension */
 				extent,          /* Length in the first dimension */
-				extent,			 /* Length in the second dimension */
+				domainSize[0],	 /* Length in the second dimension */
 				+1,              /* Forward or backward? +/- */
 				(double)1.0,     /* Scale factor for output */
 				twoDplan,        /* Planning storage */
@@ -424,17 +696,23 @@ void perform2DFFT(complexType *data, complexType *buffer, int extent, int domain
 			  );
 		}
 	#endif
+
+	TIMER_STOP(TIMER_FFT, 0);
+	return live;
 }
 
-void performAutomatic3DFFT(complexType *data, complexType *buffer, int extent, int domainSize[2])
-{ /* Uses automatic routines from a given library to perform the whole FFT */
+int performAutomatic3DFFT(complexType *buffers[2], int live, int extents[3])
+{ /* Uses automatic routines from a given library to perform the whole FFT *
+   *  Returns the index of the buffer holding the result.                 */
+	/* The library's transposes are in here too, so this isn't just FFTs */
+	TIMER_START(TIMER_FFT);
 #ifdef HAS_AUTO
 	#ifdef FFT_fftw3
-		fftw_execute(autoPlan);
+		FFTW(execute)(autoPlan);
 	#endif
 
 	#ifdef FFT_mkl
-		DftiComputeForwardDM(autoPlan, data);
+		DftiComputeForwardDM(autoPlan, buffers[live]);
 	#endif
 
 	#ifdef FFT_fftw2
@@ -447,7 +725,7 @@ void performAutomatic3DFFT(complexType *data, complexType *buffer, int extent, i
                 fftw_complex *local_data, fftw_complex *work,
                 fftwnd_mpi_output_order output_order);
 		*/
-		fftwnd_mpi(autoPlan, 1, data, buffer, FFTW_TRANSPOSED_ORDER);
+		fftwnd_mpi(autoPlan, 1, buffers[live], buffers[1 - live], FFTW_TRANSPOSED_ORDER);
 		
 	#endif
 
@@ -458,39 +736,408 @@ void performAutomatic3DFFT(complexType *data, complexType *buffer, int extent, i
 		int ip[40];
 		ip[0]=0;
 		/* pdcft3 (x, y, n1, n2, n3, isign, scale, icontxt, ip); */
-		pdcft3(data, buffer, extent, extent, extent, +1, 1.0, autoPlan, ip);
-		memcpy(data, buffer, extent*domainSize[0]*domainSize[1]*2*sizeof(double));
+		/* PESSL's 3D FFT is out of place, so the result is in the other buffer. */
+		pesslCft3(buffers[live], buffers[1 - live], extents[0], extents[1], extents[2], +1, 1.0, autoPlan, ip);
+		TIMER_STOP(TIMER_FFT, 0);
+		return 1 - live;
 	#endif
 #endif /* endif HAS_AUTO*/
+	TIMER_STOP(TIMER_FFT, 0);
+	return live;
+}
+
+void prepareFFTbatch(complexType *buffers[2], int stageExtent[3], int stageDomain[3][2], int depth)
+{ /* Prepares plans for performFFTbatch, which transforms a run of contiguous *
+   *  pencils at a time - 1/depth of the rows in a plane, for each stage.     *
+   *  Used by the pipelined transposes.                                       */
+	int s, extent;
+	
+	for(s=0;s<3;s++)
+	{
+		if (planIndex[s] != s) continue;
+		
+		extent = stageExtent[s];
+		batchPencils[s] = stageDomain[s][0] / depth;
+		
+		#ifdef FFT_fftw3
+			int b;
+			for(b=0;b<2;b++)
+			{
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+					batchPlan[s][b] = FFTW(plan_many_dft_r2c)( 1, &realLength, batchPencils[s], 
+					                                          (realType *)buffers[b], NULL, 1, 2*extent, 
+					                                          buffers[b], NULL, 1, extent, plannerFlags );
+				else
+					batchPlan[s][b] = FFTW(plan_many_dft)( 1, &extent, batchPencils[s], 
+					                                      buffers[b], NULL, 1, extent, buffers[b], NULL, 1, 
+					                                      extent, FFTW_FORWARD, plannerFlags );
+			}
+		#endif
+		
+		#ifdef FFT_fftw2
+			/* The 1D plans only fix the length, so they are reused as they are. */
+		#endif
+		
+		#ifdef FFT_mkl
+			long status;
+			if ( ( s == 0 ) && ( realLength > 0 ) )
+			{
+				status = DftiCreateDescriptor( &batchPlan[s], mklPrecision, DFTI_REAL, 1, realLength ); 
+				status = DftiSetValue( batchPlan[s], DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX ); 
+				status = DftiSetValue( batchPlan[s], DFTI_PACKED_FORMAT, DFTI_CCE_FORMAT ); 
+				status = DftiSetValue( batchPlan[s], DFTI_INPUT_DISTANCE, 2*extent ); 
+			} else {
+				status = DftiCreateDescriptor( &batchPlan[s], mklPrecision, DFTI_COMPLEX, 1, extent ); 
+				status = DftiSetValue( batchPlan[s], DFTI_INPUT_DISTANCE, extent ); 
+			}
+			status = DftiSetValue( batchPlan[s], DFTI_NUMBER_OF_TRANSFORMS, batchPencils[s] ); 
+			status = DftiSetValue( batchPlan[s], DFTI_OUTPUT_DISTANCE, extent ); 
+			status = DftiCommitDescriptor( batchPlan[s] );
+		#endif
+		
+		#ifdef FFT_acml
+			int err;
+			batchPlan[s] = malloc( ( (extent * 5) + 100 ) * sizeof(complexType) );
+			acmlFft1mx( planMode, (double)1.0, 1, batchPencils[s],
+			         extent, buffers[0], 1, extent, NULL, 1, extent, batchPlan[s], &err);
+		#endif
+		
+		#ifdef FFT_essl
+			esslCft( 1, buffers[0], 1, extent, buffers[0], 1, extent, extent, batchPencils[s], +1, (double)1.0,
+			      batchPlan[s], sizeof(batchPlan[s])/sizeof(double), NULL, 0 );
+		#endif
+	}
+}
+
+void performFFTbatch(complexType *buffers[2], int live, int stage, int extent, int firstPencil)
+{ /* Transforms a batch of pencils of the live buffer for the given stage,   *
+   *  starting at firstPencil. Unlike performFFTset, the other buffer is     *
+   *  never touched, since parts of it may be in use by communication that  *
+   *  is still in flight.                                                   */
+	int plan = planIndex[stage];
+	complexType *data = buffers[live] + firstPencil * extent;
+	
+	TIMER_START(TIMER_FFT);
+	
+	#ifdef FFT_fftw3
+		if ( ( stage == 0 ) && ( realLength > 0 ) )
+			FFTW(execute_dft_r2c)( batchPlan[plan][live], (realType *)data, data );
+		else
+			FFTW(execute_dft)( batchPlan[plan][live], data, data );
+	#endif
+	
+	#ifdef FFT_fftw2
+		/* A NULL out makes FFTW allocate its own scratch space. */
+		if ( ( stage == 0 ) && ( realLength > 0 ) )
+			rfftwnd_real_to_complex( realPlan, batchPencils[plan], (fftw_real *)data, 1, 2*extent, NULL, 1, extent );
+		else
+			fftw( oneDplan[plan], batchPencils[plan], data, 1, extent, NULL, 1, extent );
+	#endif
+	
+	#ifdef FFT_mkl
+		DftiComputeForward( batchPlan[plan], data );
+	#endif
+	
+	#ifdef FFT_acml
+		int err;
+		acmlFft1mx( -1, (double)1.0, 1, batchPencils[plan],
+		         extent, data, 1, extent, NULL, 1, extent, batchPlan[plan], &err);
+	#endif
+	
+	#ifdef FFT_essl
+		esslCft( 0, data, 1, extent, data, 1, extent, extent, batchPencils[plan], +1, (double)1.0,
+		      batchPlan[plan], sizeof(batchPlan[plan])/sizeof(double), NULL, 0 );
+	#endif
+	
+	TIMER_STOP(TIMER_FFT, 0);
 }
 
-void cleanUpFFTs(int decomp)
+void prepareInverseFFTs(complexType *buffers[2], int use2DFFT, int stageExtent[3], int stageDomain[3][2])
+{ /* Prepares the backward plans for performInverseFFTset and performInverse2DFFT, *
+   *  for the same stages as prepareFFTs, which must have been called first. With *
+   *  real input, the first stage goes back from the complex modes to real rows,  *
+   *  padded as they were.                                                        */
+	complexType *data = buffers[0];
+	int s;
+	
+	#ifdef FFT_mkl
+		long status;
+		long realDims[2] = { stageDomain[0][0], realLength };
+		/* Strides for the real 2D FFT - in complex numbers going in, in reals coming out */
+		long realInStrides[3]  = { 0, stageExtent[0], 1 };
+		long realOutStrides[3] = { 0, 2*stageExtent[0], 1 };
+	#endif
+	
+	inversePrepared = 1;
+	
+	for(s=0;s<3;s++)
+	{
+		if (planIndex[s] != s) continue;
+		
+		#ifdef FFT_fftw3
+			int b;
+			for(b=0;b<2;b++)
+			{
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+					backPlan[s][b] = FFTW(plan_many_dft_c2r)( 1, &realLength, stageDomain[s][0]*stageDomain[s][1], 
+					                                         buffers[b], NULL, 1, stageExtent[s], 
+					                                         (realType *)buffers[b], NULL, 1, 2*stageExtent[s], plannerFlags );
+				else
+					backPlan[s][b] = FFTW(plan_many_dft)( 1, &stageExtent[s], stageDomain[s][0]*stageDomain[s][1], 
+					                                     buffers[b], NULL, 1, stageExtent[s], buffers[b], NULL, 1, 
+					                                     stageExtent[s], FFTW_BACKWARD, plannerFlags );
+			}
+		#endif
+		
+		#ifdef FFT_fftw2
+			if ( ( s == 0 ) && ( realLength > 0 ) )
+				realBackPlan = rfftwnd_create_plan( 1, &realLength, FFTW_COMPLEX_TO_REAL, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS );
+			else
+				oneDbackPlan[s] = fftw_create_plan( stageExtent[s], FFTW_BACKWARD, FFTW2_PLAN_FLAGS );
+		#endif
+		
+		#ifdef FFT_mkl
+			/* A complex descriptor computes backwards as well as forwards, but a *
+			 *  real one's distances are the other way round going backwards.     */
+			if ( ( s == 0 ) && ( realLength > 0 ) )
+			{
+				status = DftiCreateDescriptor( &backPlan[s], mklPrecision, DFTI_REAL, 1, realLength ); 
+				status = DftiSetValue( backPlan[s], DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX ); 
+				status = DftiSetValue( backPlan[s], DFTI_PACKED_FORMAT, DFTI_CCE_FORMAT ); 
+				status = DftiSetValue( backPlan[s], DFTI_NUMBER_OF_TRANSFORMS, stageDomain[s][0]*stageDomain[s][1] ); 
+				status = DftiSetValue( backPlan[s], DFTI_INPUT_DISTANCE, stageExtent[s] ); 
+				status = DftiSetValue( backPlan[s], DFTI_OUTPUT_DISTANCE, 2*stageExtent[s] ); 
+				status = DftiCommitDescriptor( backPlan[s] );
+			}
+		#endif
+		
+		#ifdef FFT_acml
+			/* The forward plans are used - the mode says which way to go. */
+		#endif
+		
+		#ifdef FFT_essl
+			esslCft( 1, data, 1, stageExtent[s], data, 1, stageExtent[s], stageExtent[s], 
+			      stageDomain[s][0]*stageDomain[s][1], -1, (double)1.0,
+			      backPlan[s], sizeof(backPlan[s])/sizeof(double), NULL, 0 );
+		#endif
+	}
+	
+	if (use2DFFT == 1)
+	{
+		#ifdef FFT_fftw3
+			if (realLength > 0)
+				twoDbackPlan = FFTW(plan_dft_c2r_2d)( stageDomain[0][0], realLength, data, (realType *)data, plannerFlags );
+			else
+				twoDbackPlan = FFTW(plan_dft_2d)( stageDomain[0][0], stageExtent[0], data, data, FFTW_BACKWARD, plannerFlags );
+		#endif
+		
+		#ifdef FFT_fftw2
+			if (realLength > 0)
+				twoDbackPlan = rfftw2d_create_plan(stageDomain[0][0], realLength, FFTW_COMPLEX_TO_REAL, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS);
+			else
+				twoDbackPlan = fftw2d_create_plan(stageDomain[0][0], stageExtent[0], FFTW_BACKWARD, FFTW2_PLAN_FLAGS | FFTW2_THREAD_FLAGS);
+		#endif
+		
+		#ifdef FFT_mkl
+			if (realLength > 0)
+			{
+				status = DftiCreateDescriptor( &twoDbackPlan, mklPrecision, DFTI_REAL, 2, realDims );
+				status = DftiSetValue( twoDbackPlan, DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX );
+				status = DftiSetValue( twoDbackPlan, DFTI_PACKED_FORMAT, DFTI_CCE_FORMAT );
+				status = DftiSetValue( twoDbackPlan, DFTI_INPUT_STRIDES, realInStrides );
+				status = DftiSetValue( twoDbackPlan, DFTI_OUTPUT_STRIDES, realOutStrides );
+				status = DftiCommitDescriptor( twoDbackPlan );
+			}
+		#endif
+		
+		#ifdef FFT_essl
+			esslCft2( 1, data, 1, stageExtent[0], data, 1, stageExtent[0], stageExtent[0], stageDomain[0][0],
+			       -1, 1.0, twoDbackPlan, sizeof(twoDbackPlan)/sizeof(double), NULL, 0 );
+		#endif
+	}
+}
+
+int performInverseFFTset(complexType *buffers[2], int live, int stage, int extent, int domainSize[2])
+{ /* As performFFTset, but backwards, using the plans from prepareInverseFFTs. *
+   *  Nothing is normalised, so a round trip multiplies the data by the       *
+   *  number of points in the grid.                                           */
+	int plan = planIndex[stage];
+	
+	TIMER_START(TIMER_FFT);
+	
+	#ifdef FFT_fftw3
+		FFTW(execute)( backPlan[plan][live] );
+	#endif
+	
+	#ifdef FFT_fftw2
+		complexType *data   = buffers[live];
+		complexType *buffer = buffers[1 - live];
+		int t, first, count;
+		
+		/* Shared out between the threads as in performFFTset */
+		OMP_FOR(private(first, count))
+		for(t=0;t<fftThreads;t++)
+		{
+			first = blockStart(domainSize[0]*domainSize[1], fftThreads, t);
+			count = blockSize(domainSize[0]*domainSize[1], fftThreads, t);
+			if ( ( stage == 0 ) && ( realLength > 0 ) )
+				rfftwnd_complex_to_real( realBackPlan, count,
+				                         data + first*extent, 1, extent, NULL, 1, 2*extent );
+			else
+				fftw( oneDbackPlan[plan], count,
+				      data + first*extent, 1, extent, buffer + first*extent, 1, extent );
+		}
+	#endif
+	
+	#ifdef FFT_mkl
+		if ( ( stage == 0 ) && ( realLength > 0 ) )
+			DftiComputeBackward( backPlan[plan], buffers[live] );
+		else
+			DftiComputeBackward( oneDplan[plan], buffers[live] );
+	#endif
+	
+	#ifdef FFT_acml
+		complexType *data = buffers[live];
+		int err;
+		/* Mode 1 is a backward FFT with the plan made in prepareFFTs */
+		acmlFft1mx( 1, (double)1.0, 1, domainSize[0]*domainSize[1],
+		         extent, data, 1, extent, NULL, 1, extent, oneDplan[plan], &err);
+	#endif
+	
+	#ifdef FFT_essl
+		complexType *data = buffers[live];
+		esslCft( 0, data, 1, extent, data, 1, extent, extent, domainSize[0]*domainSize[1], -1, (double)1.0,
+		      backPlan[plan], sizeof(backPlan[plan])/sizeof(double), NULL, 0 );
+	#endif
+	
+	TIMER_STOP(TIMER_FFT, 0);
+	return live;
+}
+
+int performInverse2DFFT(complexType *buffers[2], int live, int extent, int domainSize[2])
+{ /* As perform2DFFT, but backwards. */
+	int i;
+	int slab = domainSize[0] * extent;
+	complexType *data = buffers[live];
+	
+	TIMER_START(TIMER_FFT);
+	
+	/* FFTW2's slabs are shared out between threads, as in perform2DFFT - *
+	 *  the other libraries thread each transform themselves.            */
+	#ifdef FFT_fftw2
+		OMP_FOR()
+	#endif
+	for(i=0;i<domainSize[1];i++)
+	{
+		#ifdef FFT_fftw3
+			if (realLength > 0)
+				FFTW(execute_dft_c2r)( twoDbackPlan, data + i*slab, (realType *)(data + i*slab) );
+			else
+				FFTW(execute_dft)( twoDbackPlan, data + i*slab, data + i*slab );
+		#endif
+		
+		#ifdef FFT_fftw2
+			if (realLength > 0)
+				rfftwnd_one_complex_to_real(twoDbackPlan, data + i*slab, NULL);
+			else
+				fftwnd_one(twoDbackPlan, data + i*slab, data + i*slab);
+		#endif
+		
+		#ifdef FFT_mkl
+			if (realLength > 0)
+				DftiComputeBackward( twoDbackPlan, data + i*slab );
+			else
+				DftiComputeBackward( twoDplan, data + i*slab );
+		#endif
+		
+		#ifdef FFT_acml
+			int err;
+			acmlFft2dx( 1, (double)1.0, 0, 1, extent, domainSize[0], 
+			         data + i*slab, 1, extent, 
+			         data + i*slab, 1, extent, twoDplan, &err );
+		#endif
+		
+		#ifdef FFT_essl
+			/* Left to allocate its own working space - see perform2DFFT */
+			esslCft2( 0, data + i*slab, 1, extent, data + i*slab, 1, extent, extent, domainSize[0],
+			       -1, (double)1.0, twoDbackPlan, sizeof(twoDbackPlan)/sizeof(double), NULL, 0 );
+		#endif
+	}
+	
+	TIMER_STOP(TIMER_FFT, 0);
+	return live;
+}
+
+void cleanUpFFTs(int decomp, int use2DFFT)
 { /* If applicable, free memory associated with plans. */
   /* This may not actually be necessary, but "always free what you alloc". */
+  /* Plans shared between stages are only freed by the stage that owns them. */
+  /* Afterwards prepareFFTs can be called again, for another decomposition.  */
+	int s;
 
 	#ifdef FFT_fftw3
-		if (decomp != 0)
-			fftw_destroy_plan(oneDplan);
+		for(s=0;s<3;s++)
+		{
+			if (planIndex[s] != s) continue;
+			
+			if (decomp != 0)
+			{
+				FFTW(destroy_plan)(oneDplan[s][0]);
+				FFTW(destroy_plan)(oneDplan[s][1]);
+			}
+			
+			if (batchPencils[s] != 0)
+			{
+				FFTW(destroy_plan)(batchPlan[s][0]);
+				FFTW(destroy_plan)(batchPlan[s][1]);
+			}
+			
+			if (inversePrepared == 1)
+			{
+				FFTW(destroy_plan)(backPlan[s][0]);
+				FFTW(destroy_plan)(backPlan[s][1]);
+			}
+		}
 		
-		if (decomp == 1)
-			fftw_destroy_plan(twoDplan);
+		if (use2DFFT == 1)
+			FFTW(destroy_plan)(twoDplan);
+		if ( ( use2DFFT == 1 ) && ( inversePrepared == 1 ) )
+			FFTW(destroy_plan)(twoDbackPlan);
 			
 		#ifdef FFT_fftw3_mpi
 		    if (decomp == 0)
 			{
-				fftw_destroy_plan(autoPlan);
-				fftw_mpi_cleanup();
+				FFTW(destroy_plan)(autoPlan);
+				FFTW(mpi_cleanup)();
 			}
 		#endif
+		
+		#ifdef _OPENMP
+			FFTW(cleanup_threads)();
+		#endif
 	#endif
 
 	#ifdef FFT_mkl
 		long status;
-		if (decomp != 0)
-			status = DftiFreeDescriptor( &oneDplan );
+		for(s=0;s<3;s++)
+		{
+			if (planIndex[s] != s) continue;
+			if (decomp != 0)
+				status = DftiFreeDescriptor( &oneDplan[s] );
+			if (batchPencils[s] != 0)
+				status = DftiFreeDescriptor( &batchPlan[s] );
+		}
 		
-		if (decomp == 1)
+		if (use2DFFT == 1)
 			status = DftiFreeDescriptor( &twoDplan );
+		
+		/* Only the real transforms needed descriptors of their own to go backwards */
+		if ( ( inversePrepared == 1 ) && ( realLength > 0 ) )
+		{
+			status = DftiFreeDescriptor( &backPlan[0] );
+			if (use2DFFT == 1)
+				status = DftiFreeDescriptor( &twoDbackPlan );
+		}
 		#ifdef HAS_AUTO
 			if (decomp == 0)
 				status = DftiFreeDescriptorDM( &autoPlan );
@@ -499,10 +1146,27 @@ void cleanUpFFTs(int decomp)
 
 	#ifdef FFT_fftw2
 		if (decomp != 0)
-			fftw_destroy_plan(oneDplan);
+		{
+			for(s=0;s<3;s++)
+			{
+				if (planIndex[s] != s) continue;
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+					rfftwnd_destroy_plan(realPlan);
+				else
+					fftw_destroy_plan(oneDplan[s]);
+				
+				if (inversePrepared == 0) continue;
+				if ( ( s == 0 ) && ( realLength > 0 ) )
+					rfftwnd_destroy_plan(realBackPlan);
+				else
+					fftw_destroy_plan(oneDbackPlan[s]);
+			}
+		}
 			
-		if (decomp == 1)
+		if (use2DFFT == 1)
 			fftwnd_destroy_plan(twoDplan);
+		if ( ( use2DFFT == 1 ) && ( inversePrepared == 1 ) )
+			fftwnd_destroy_plan(twoDbackPlan);
 		
 		#ifdef HAS_AUTO	
 			if (decomp == 0)
@@ -511,13 +1175,25 @@ void cleanUpFFTs(int decomp)
 	#endif
 
 	#ifdef FFT_acml
-		free(oneDplan);
-		if (decomp == 1)
+		for(s=0;s<3;s++)
+		{
+			if (planIndex[s] != s) continue;
+			free(oneDplan[s]);
+			if (batchPencils[s] != 0)
+				free(batchPlan[s]);
+		}
+		if (use2DFFT == 1)
 			free(twoDplan);
 	#endif
 
 	#ifdef FFT_essl
 	#endif
+	
+	for(s=0;s<3;s++)
+	{
+		batchPencils[s] = 0;
+	}
+	inversePrepared = 0;
 }
 
 int libraryHasAutomaticDecomposition()
@@ -559,6 +1235,200 @@ int libraryHasAutomaticDecomposition()
 	#endif	
 }
 
+int libraryHasRealTransforms()
+{ /* Used for validateParameters. ESSL and ACML have real-to-complex FFTs, but   *
+   *  with their own storage for the result, which the transposes don't handle. */
+	#ifdef FFT_fftw3
+		return 1;
+	#endif
+	
+	#ifdef FFT_fftw2
+		return 1;
+	#endif
+	
+	#ifdef FFT_acml
+		return 0;
+	#endif
+	
+	#ifdef FFT_mkl
+		return 1;
+	#endif
+	
+	#ifdef FFT_essl
+		return 0;
+	#endif
+}
+
+int libraryHasWisdom()
+{ /* Used for validateParameters. Only the FFTWs can save what their planning *
+   *  found out for later runs.                                              */
+	#if defined(FFT_fftw3) || defined(FFT_fftw2)
+		return 1;
+	#else
+		return 0;
+	#endif
+}
+
+const char *libraryVersion()
+{ /* For the results file - the version the library says it is, where it will. */
+	#ifdef FFT_fftw3
+		return FFTW(version);
+	#endif
+	
+	#ifdef FFT_fftw2
+		return fftw_version;
+	#endif
+	
+	#ifdef FFT_mkl
+		static char version[200];
+		MKL_Get_Version_String(version, sizeof(version));
+		return version;
+	#endif
+	
+	#ifdef FFT_acml
+		static char version[40];
+		int major, minor, patch;
+		acmlversion(&major, &minor, &patch);
+		sprintf(version, "%d.%d.%d", major, minor, patch);
+		return version;
+	#endif
+	
+	#ifdef FFT_essl
+		return "unknown";
+	#endif
+}
+
+#if defined(FFT_fftw3) || defined(FFT_fftw2)
+	/* What loadWisdom read, so saveWisdom can tell whether there's anything new */
+	char *loadedWisdom = NULL;
+#endif
+
+void loadWisdom(const char *fileName, MPI_Comm comm)
+{ /* Rank 0 reads the wisdom saved by earlier runs, if there is any, and shares *
+   *  it with the rest, so that their planning can skip the measurements that  *
+   *  were made then. Must come before prepareFFTs.                            */
+	#if defined(FFT_fftw3) || defined(FFT_fftw2)
+		int length = 0;
+		int imported;
+		FILE *file;
+		
+		if (amMaster(comm))
+		{
+			file = fopen(fileName, "r");
+			if (file != NULL)
+			{
+				fseek(file, 0, SEEK_END);
+				length = (int)ftell(file);
+				rewind(file);
+				if ( NULL == ( loadedWisdom = malloc(length + 1) ) )
+				{
+					fprintf(stderr, "Could not allocate space for wisdom.\n");
+					MPI_Abort(comm, 5);
+				}
+				length = (int)fread(loadedWisdom, 1, length, file);
+				loadedWisdom[length] = '\0';
+				fclose(file);
+			}
+		}
+		
+		MPI_Bcast(&length, 1, MPI_INT, 0, comm);
+		if (length == 0) return;
+		
+		if ( ( !amMaster(comm) ) && ( NULL == ( loadedWisdom = malloc(length + 1) ) ) )
+		{
+			fprintf(stderr, "Could not allocate space for wisdom.\n");
+			MPI_Abort(comm, 5);
+		}
+		MPI_Bcast(loadedWisdom, length + 1, MPI_CHAR, 0, comm);
+		
+		#ifdef FFT_fftw3
+			imported = FFTW_WISDOM_IMPORT(loadedWisdom);
+		#endif
+		#ifdef FFT_fftw2
+			imported = ( FFTW_SUCCESS == FFTW_WISDOM_IMPORT(loadedWisdom) );
+		#endif
+		
+		/* Not fatal - the plans are just made from scratch */
+		if ( ( imported == 0 ) && amMaster(comm) )
+			fprintf(stderr, "Wisdom in %s could not be read - ignoring it.\n", fileName);
+	#endif
+}
+
+void saveWisdom(const char *fileName, MPI_Comm comm)
+{ /* Gathers the wisdom from every processor - their domains can differ in shape, *
+   *  so they needn't have made the same plans - and has rank 0 write it all to   *
+   *  fileName, unless it's no more than loadWisdom found there.                 */
+	#if defined(FFT_fftw3) || defined(FFT_fftw2)
+		char *wisdom, *others = NULL;
+		int length, p, peers;
+		int *lengths = NULL, *offsets = NULL;
+		FILE *file;
+		
+		peers = getSize(comm);
+		wisdom = FFTW_WISDOM_EXPORT();
+		length = strlen(wisdom) + 1;
+		
+		if (amMaster(comm))
+		{
+			lengths = malloc(peers * sizeof(int));
+			offsets = malloc(peers * sizeof(int));
+			if ( ( lengths == NULL ) || ( offsets == NULL ) )
+			{
+				fprintf(stderr, "Could not allocate space for wisdom.\n");
+				MPI_Abort(comm, 5);
+			}
+		}
+		MPI_Gather(&length, 1, MPI_INT, lengths, 1, MPI_INT, 0, comm);
+		
+		if (amMaster(comm))
+		{
+			offsets[0] = 0;
+			for(p=1;p<peers;p++)
+			{
+				offsets[p] = offsets[p - 1] + lengths[p - 1];
+			}
+			if ( NULL == ( others = malloc(offsets[peers - 1] + lengths[peers - 1]) ) )
+			{
+				fprintf(stderr, "Could not allocate space for wisdom.\n");
+				MPI_Abort(comm, 5);
+			}
+		}
+		MPI_Gatherv(wisdom, length, MPI_CHAR, others, lengths, offsets, MPI_CHAR, 0, comm);
+		FFTW_WISDOM_FREE(wisdom);
+		
+		if (amMaster(comm))
+		{
+			/* Importing adds to what rank 0 already knows */
+			for(p=1;p<peers;p++)
+			{
+				FFTW_WISDOM_IMPORT(others + offsets[p]);
+			}
+			wisdom = FFTW_WISDOM_EXPORT();
+			
+			if ( ( loadedWisdom == NULL ) || ( strcmp(wisdom, loadedWisdom) != 0 ) )
+			{
+				file = fopen(fileName, "w");
+				if (file != NULL)
+				{
+					fputs(wisdom, file);
+					fclose(file);
+				} else {
+					/* Not fatal either - the next run just plans again */
+					fprintf(stderr, "Wisdom could not be written to %s.\n", fileName);
+				}
+			}
+			
+			FFTW_WISDOM_FREE(wisdom);
+			free(others);
+			free(lengths);
+			free(offsets);
+		}
+		
+		free(loadedWisdom);
+		loadedWisdom = NULL;
+	#endif
+}
+
 
 /*********************************
  * Complex Number Functions.     *
@@ -728,5 +1598,5 @@ _Complex double complexNative( complexType z )
 
 void printLib()
 {
-	fprintf(stderr, "This executable uses the %s library.\n", FFT_NAME);
+	fprintf(stderr, "This executable uses the %s library, in %s precision.\n", FFT_NAME, PRECISION_NAME);
 }
\ No newline at end of file
@@ -6,11 +6,15 @@
  *   numbers, FFT planning and execution, and would also contain the 
  *   definition of the appropriate MPI type to represent the complex 
  *   number, except that I decided to assume they were all just two 
- *   MPI_DOUBLEs. (Bit compatability can be verified.) 
+ *   MPI_DOUBLEs. (Bit compatability can be verified.) In single
+ *   precision they're two MPI_FLOATs - see REAL_MPI_TYPE.
  *
  * Defining HAS_AUTO in compilation is an instruction to use the parallel
  *  version of the library as well.
  *
+ * Defining FFT_SINGLE uses the library's single precision transforms
+ *  instead of the double precision ones.
+ *
  * We use the less eye-friendly version of the C complex number type
  *  to avoid namespace collisions -- complex is equivalent to _Complex.
  *
@@ -36,20 +40,56 @@
 #endif
 #endif
 
+/* The type of each half of a complex number, and how MPI sees it */
+#ifdef FFT_SINGLE
+	typedef float realType;
+	#define REAL_MPI_TYPE MPI_FLOAT
+	#define PRECISION_NAME "single"
+#else
+	typedef double realType;
+	#define REAL_MPI_TYPE MPI_DOUBLE
+	#define PRECISION_NAME "double"
+#endif
+
+/* Loops shared out between OpenMP threads start with OMP_FOR, given the *
+ *  clauses of an omp parallel for. Without OpenMP it's empty, so the     *
+ *  compiler never sees a pragma it might not know.                       */
+#ifdef _OPENMP
+	#define OMP_PRAGMA(...) _Pragma(#__VA_ARGS__)
+	#define OMP_FOR(...)    OMP_PRAGMA(omp parallel for __VA_ARGS__)
+#else
+	#define OMP_FOR(...)
+#endif
+
 /* Include FFT library of choice */
 #ifdef FFT_fftw2
-	#ifdef FFTW_TYPE_SPECIFIED
+	#if defined(FFTW_TYPE_SPECIFIED) && defined(FFT_SINGLE)
+		#include <sfftw.h>
+		#include <srfftw.h>
+		#ifdef HAS_AUTO
+			#include <sfftw_mpi.h>
+		#endif
+	#elif defined(FFTW_TYPE_SPECIFIED)
 		#include <dfftw.h>
+		#include <drfftw.h>
 		#ifdef HAS_AUTO
 			#include <dfftw_mpi.h>
 		#endif
 	#else
 		#include <fftw.h>
+		#include <rfftw.h>
 		#ifdef HAS_AUTO
 			#include <fftw_mpi.h>
 		#endif
 	#endif
 	
+	/* FFTW2 has one set of calls, for whichever precision it was built in. */
+	#if defined(FFT_SINGLE) && !defined(FFTW_ENABLE_FLOAT)
+		#error "This FFTW2 is double precision - a single precision build needs one configured with --enable-float."
+	#elif !defined(FFT_SINGLE) && defined(FFTW_ENABLE_FLOAT)
+		#error "This FFTW2 is single precision - build with PRECISION=single, or use a double precision FFTW2."
+	#endif
+	
 	#define FFT_NAME "fftw2"
 	#define FFT_fftw2_LIBKEY 
 	typedef fftw_complex complexType;
@@ -65,10 +105,17 @@
 	#define FFT_NAME "fftw3"
 	#define FFT_fftw3_LIBKEY 1
 	
-	typedef fftw_complex complexType;
-	typedef fftw_plan planType;
+	/* The single precision calls and types are the double ones, prefixed fftwf_ */
+	#ifdef FFT_SINGLE
+		#define FFTW(name) fftwf_ ## name
+	#else
+		#define FFTW(name) fftw_ ## name
+	#endif
+	
+	typedef FFTW(complex) complexType;
+	typedef FFTW(plan) planType;
 	#ifdef HAS_AUTO
-		typedef fftw_plan parallelPlanType;
+		typedef FFTW(plan) parallelPlanType;
 	#endif
 #endif
 
@@ -77,7 +124,17 @@
 	#define FFT_NAME "essl"
 	#define FFT_essl_LIBKEY 2
 	
-	typedef dcmplx complexType;
+	#ifdef FFT_SINGLE
+		typedef cmplx complexType;
+		#define esslCft   scft
+		#define esslCft2  scft2
+		#define pesslCft3 pscft3
+	#else
+		typedef dcmplx complexType;
+		#define esslCft   dcft
+		#define esslCft2  dcft2
+		#define pesslCft3 pdcft3
+	#endif
 	typedef double planType[20000];
 	
 	#ifdef HAS_AUTO
@@ -89,10 +146,21 @@
 #endif
 
 #ifdef FFT_acml
+	/* ACML's single precision complex type is called complex, which complex.h *
+	 *  would turn into _Complex - but we only ever use _Complex anyway.       */
+	#undef complex
 	#include <acml.h>
 	#define FFT_NAME "acml"
 	#define FFT_acml_LIBKEY 3
-	typedef doublecomplex complexType;
+	#ifdef FFT_SINGLE
+		typedef complex complexType;
+		#define acmlFft1mx cfft1mx
+		#define acmlFft2dx cfft2dx
+	#else
+		typedef doublecomplex complexType;
+		#define acmlFft1mx zfft1mx
+		#define acmlFft2dx zfft2dx
+	#endif
 	
 	/* In ACML, the closest you can get to making a plan is to run
 	 * a transform and have it save the data in the array it uses as a buffer,
@@ -103,21 +171,53 @@
 
 #ifdef FFT_mkl
 	#include <mkl_dfti.h>
+	#include <mkl_service.h> /* For mkl_set_num_threads and MKL_Get_Version_String */
 	#define FFT_NAME "mkl"
 	#define FFT_mkl_LIBKEY 4
-	typedef _Complex double complexType;
+	#ifdef FFT_SINGLE
+		typedef _Complex float complexType;
+		#define mklPrecision DFTI_SINGLE
+	#else
+		typedef _Complex double complexType;
+		#define mklPrecision DFTI_DOUBLE
+	#endif
 	typedef DFTI_DESCRIPTOR_HANDLE planType;
 	#ifdef HAS_AUTO
 		typedef DFTI_DESCRIPTOR_DM_HANDLE parallelPlanType;
 	#endif
 #endif
 
-void prepareFFTs(complexType *data, int decomp, int use2DFFT, int extent, int domainSize[2], MPI_Comm commColumn);
-void performFFTset(complexType *data, complexType *buffer, int extent, int domainSize[2]);
-void perform2DFFT(complexType *data, complexType *buffer, int extent, int domainSize[2]);
-void performAutomatic3DFFT(complexType *data, complexType *buffer, int extent, int domainSize[2]);
-void cleanUpFFTs(int decomp);
+/* Planner effort - goes in plannerEffort. Libraries without some of these *
+ *  fall back to the nearest they have - see setPlannerEffort.             */
+#define PLAN_ESTIMATE   0
+#define PLAN_MEASURE    1
+#define PLAN_PATIENT    2
+#define PLAN_EXHAUSTIVE 3
+#define PLAN_EFFORT_COUNT 4
+#define PLAN_FIXED     -1 /* The library plans the one way whatever it's told */
+
+/* The perform* calls act on buffers[live] and return which buffer now holds *
+ *  the result, so callers can follow the data without copying it back.     */
+void prepareFFTthreads(int threads);
+int setPlannerEffort(int effort);
+const char *plannerEffortName(int effort);
+void prepareFFTs(complexType *buffers[2], int decomp, int use2DFFT, int realInput, int extents[3],
+                 int stageExtent[3], int stageDomain[3][2], MPI_Comm commColumn);
+int performFFTset(complexType *buffers[2], int live, int stage, int extent, int domainSize[2]);
+int perform2DFFT(complexType *buffers[2], int live, int extent, int domainSize[2]);
+int performAutomatic3DFFT(complexType *buffers[2], int live, int extents[3]);
+void prepareFFTbatch(complexType *buffers[2], int stageExtent[3], int stageDomain[3][2], int depth);
+void performFFTbatch(complexType *buffers[2], int live, int stage, int extent, int firstPencil);
+void prepareInverseFFTs(complexType *buffers[2], int use2DFFT, int stageExtent[3], int stageDomain[3][2]);
+int performInverseFFTset(complexType *buffers[2], int live, int stage, int extent, int domainSize[2]);
+int performInverse2DFFT(complexType *buffers[2], int live, int extent, int domainSize[2]);
+void cleanUpFFTs(int decomp, int use2DFFT);
 int libraryHasAutomaticDecomposition();
+int libraryHasRealTransforms();
+int libraryHasWisdom();
+const char *libraryVersion();
+void loadWisdom(const char *fileName, MPI_Comm comm);
+void saveWisdom(const char *fileName, MPI_Comm comm);
 
 void printLib();
 void complexSwap(complexType *, complexType *);
@@ -11,76 +11,915 @@
 #include <mpi.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "A2A3D.h"
+#include "autotune.h"
 #include "comms.h"
 #include "dataOps.h"
 #include "decomposition.h"
+#include "jsonOutput.h"
 #include "libDefs.h"
 #include "options.h"
 #include "performLocalTranspose.h"
+#include "statistics.h"
+#include "timers.h"
 #include "validateParameters.h"
 
-#define TOLERANCE 1e-10
+/* The residue is an average error per point, which single precision *
+ *  can't get anywhere near as low.                                  */
+#ifdef FFT_SINGLE
+	#define TOLERANCE 1e-3
+#else
+	#define TOLERANCE 1e-10
+#endif
 
-int main (int argc, char ** argv) {
+/* What the benchmark was built with, if the Makefile said */
+#ifndef BUILD_COMPILER
+	#define BUILD_COMPILER "unknown"
+#endif
+#ifndef BUILD_FLAGS
+	#define BUILD_FLAGS "unknown"
+#endif
+
+/* The settings and state of the benchmark. They're kept at file scope so that  *
+ *  the autotuner can set up, time and tear down each configuration it tries   *
+ *  with the same functions that the benchmark itself is run with.             */
+
+/* Double buffer data - AlltoAll cannot be performed in-place */
+static complexType *data[2];
+static int live = 0;       /* Which of the two buffers currently holds the data */
+static MPI_Win dataWindows[2] = {MPI_WIN_NULL, MPI_WIN_NULL}; /* Sharing them, for ENGINE_SHARED */
+
+static int extents[3];         /* Size of whole problem along x, y and z            */
+static int stageGlobal[3][2];  /*  and in total, and per processor, along each      */
+static int stageDomain[3][2];  /*  decomposable dimension and the FFT axis, before  */
+static int stageExtent[3];     /*  each FFT set                                     */
+static double imbalance;       /* Most work on one processor over the average      */
+
+static char sizeName[40];  /* For output string */
+static int decomp;         /* Decomposition type - 1 for slab, 2 for rod */
+static int use2DFFT = 0;   /* 1 if we're using the library's 2D FFT, otherwise 0 */
+static int realInput = 0;  /* 1 if the input is real, and transformed real-to-complex */
+
+static int skip    = 0;    /* Skip all work */
+static int skipFFT = 0;    /* Skip FFTs, just ATA */
+static int printOut= 0;    /* Print out the data instead of checking it at the end */
+static int roundTrip = 0;  /* Follow each forward transform with the inverse */
+static int packMethod = PACK_BLOCKED; /* Which pack/unpack kernels the transposes use */
+static int engine = ENGINE_PACK;      /* How the distributed transposes are done */
+static int ataWindow = DEFAULT_ATA_WINDOW; /* Messages the windowed all-to-all keeps in flight */
+static int pipelineDepth = 0;         /* Groups to pipeline each transpose in, 0 for none */
+static int threads = 0;               /* OpenMP threads in each process, 0 for the default */
+static char *wisdomDir = NULL;        /* Where plans are kept between runs, if anywhere */
+static char wisdomFile[FILENAME_MAX]; /*  and the file for this configuration's        */
+static int plannerEffort = PLAN_MEASURE; /* How hard to look for fast FFTs          */
+static double planTime;                  /* Spent planning, on the slowest processor */
+static char *tuneDir = NULL;          /* Where the autotuner keeps its choice, if it's on */
+static char tuneFile[FILENAME_MAX];   /*  and the file for this size and processor count */
+static char *resultsFileName = NULL;  /* Where the JSON lines go, if anywhere            */
+static FILE *resultsFile = NULL;      /*  - open on the master                          */
+static char runStarted[32];           /* When this run began, in UTC                    */
+static char runId[MPI_MAX_PROCESSOR_NAME + 64]; /* Ties the run's records together      */
+
+static double phaseTime[6]; /* Tracks time for each phase of FFT */
+static double inverseTime[6]; /*  and of the inverse, in a round trip */
+
+/* The phases between those times, as the result lines name them */
+#define PHASES 10
+static const char *phaseNames[PHASES] = {
+	"fft-x", "transpose-1", "fft-y", "transpose-2", "fft-z",
+	"inverse-fft-z", "inverse-transpose-2", "inverse-fft-y", "inverse-transpose-1", "inverse-fft-x" };
+static phaseStats phaseSpread[PHASES + 1]; /* Each phase over the processors, then the total */
+static int phaseCount;                     /*  - the phases that were run                   */
+#ifdef SUBPHASE_TIMERS
+static phaseStats subphaseSpread[TIMER_COUNT]; /* Each of the steps timers.h names, */
+static double subphaseBytes[TIMER_COUNT];      /*  and what each processor moved    */
+#endif
+static double totalTime;
+static double fftTime, reorgTime;  /* Totals for the result line */
+static double exposedCommTime;     /* Communication time the FFTs didn't hide */
+static double hiddenComm;          /* Fraction of communication that was hidden */
+static pipelineStats pipeStats;    /* Filled in by the pipelined transposes */
+
+static int transposes;       /* Distributed transposes in each transform,        */
+static double bytesSent;     /*  the bytes all of them send between processors, */
+static double bytesOffNode;  /*  and between nodes                              */
+static double gflops;        /* Estimated rate of the last transform            */
+static double rankBandwidth; /*  and of its transposes, from each processor,   */
+static double linkBandwidth; /*  and out of each node                          */
+
+/* Each kind of result line's columns, printed once as fft-columns lines so that *
+ *  the output says what it holds. The version goes up whenever any change.      */
+#define RESULTS_VERSION 1
+static const char *resultColumns = "size,extent,decomp,fft-dims,library,reorg-time,fft-time,total-time,"
+	"engine,pipeline-depth,exposed-comm-time,hidden-comm,load-imbalance,transform,direction,precision,"
+	"threads,planner-effort,plan-time,window,slowest-total-time,time-imbalance,"
+	"gflops,gflops-per-rank,transpose-bytes,bandwidth-per-rank,bandwidth-per-link";
+static const char *phaseColumns = "size,extent,decomp,engine,phase,min,mean,max,imbalance,slowest-rank,slowest-node";
+#ifdef SUBPHASE_TIMERS
+static const char *subphaseColumns = "size,extent,decomp,engine,step,min,mean,max,imbalance,bytes,bandwidth";
+#endif
+static const char *summaryColumns = "size,extent,decomp,engine,phase,count,median,p10,p90,mean,stddev,ci-low,ci-high";
+
+/*** How many times we run the test. ***/
+static int targetLoopCount = 1;
+static int warmUp = 0;          /* Untimed transforms before them                   */
+static int summarise = 0;       /* Print one summary of them all, rather than lines */
+static double precision = 0;    /*  carrying on until the mean total time is known  */
+static double budget = 0;       /*  this well, or for this long, if either is set   */
+
+/* The slowest processor's time for each phase of each timed transform, and for *
+ *  the whole of it, PHASES + 1 to a row, for the summary.                      */
+#define MAX_SAMPLES 100000
+static double *samples = NULL;
+static int sampleCount = 0, sampleSpace = 0;
 
-	/* Double buffer data - AlltoAll cannot be performed in-place */
-	complexType *data[2];
+/*** MPI Variables ***/
+static int size;          /* Global number of tasks */
+static int cartCoords[2]; /* Coordinates within the Cartesian communicator */
+static int decompDims[2]; /* Number of processors along each dimension of the decomp */
+static int procGrid[2] = {0,0}; /*  if given with -g                                   */
+static int nodeAware = 0; /* Place processors so each row transpose is within a node */
+static int rowsOnNode;    /* Rows of the grid that are, for the output       */
+static int nodes;         /*  and how many nodes there are                   */
+static int node;          /*  and which one this processor is on             */
+
+static MPI_Comm commAll;  /* MPI_COMM_WORLD, until made Cartesian by makeDecomposition */
+
+static ataInfo ataRow, ataCol; /* Stored All-to-All information */
+static ataInfo ataRowBack, ataColBack; /*  and for the inverse transposes */
+
+
+static void setUpRun()
+{ /* Makes the decomposition, buffers, transposes and plans for the configuration in *
+   *  decomp, use2DFFT, engine and decompDims - see makeDecomposition for the last.  */
+	/* Prepares a whole bunch of stuff -            */
+	makeDecomposition(decompDims, stageGlobal, stageDomain, stageExtent, extents, decomp, use2DFFT,
+					  realInput, size, cartCoords, &ataRow, &ataCol, &commAll, nodeAware);
+	imbalance = loadImbalance(stageDomain, stageExtent, commAll);
+	rowsOnNode = rowsWithinNodes(&ataRow, commAll, &nodes);
+	nodeInfo(commAll, &node, &nodes);
+	ataRow.packMethod = packMethod;
+	ataCol.packMethod = packMethod;
+	ataRow.engine = engine;
+	ataCol.engine = engine;
+	ataRow.window = ataWindow;
+	ataCol.window = ataWindow;
 	
-	int extent;         /* Size of whole problem cube (extent*extent*extent)    */
-	int domainSize[2];  /*  and per processor along each decomposable dimension */
+	validatePipeline(pipelineDepth, decomp, engine, stageDomain);
+	preparePipeline(&ataRow, &ataCol, stageDomain, stageExtent, pipelineDepth);
 	
-	char decompName[5]; /* For output string */
-	int decomp;         /* Decomposition type - 1 for slab, 2 for rod */
-	int use2DFFT = 0;   /* 1 if we're using the library's 2D FFT, otherwise 0 */
+	if (roundTrip == 1)
+	{
+		makeInverseDecomposition(stageGlobal, stageDomain, stageExtent, &ataRow, &ataCol, 
+		                         &ataRowBack, &ataColBack);
+		ataRowBack.packMethod = packMethod;
+		ataColBack.packMethod = packMethod;
+		ataRowBack.engine = engine;
+		ataColBack.engine = engine;
+		ataRowBack.window = ataWindow;
+		ataColBack.window = ataWindow;
+	}
+
+	
+	/* Create the buffers & FFT handlers to use for *
+     *  the FFTs.                                   *
+	 * prepareFFTs may destroy some of the data     *
+	 *  in the array, so we populate it later.      *
+     * We also want the population inside a loop    *
+     *  so we can run the benchmark repeatedly      *
+     *  without re-running the whole code.          */           
+	if (engine == ENGINE_SHARED)
+		makeSharedDataArrays(data, dataWindows, stageExtent, stageDomain, commAll);
+	else
+		makeDataArrays(data, stageExtent, stageDomain);
+	prepareATAengine(&ataRow, data, dataWindows, stageDomain[0], stageExtent[0]);
+	prepareATAengine(&ataCol, data, dataWindows, stageDomain[1], stageExtent[1]);
+	if (roundTrip == 1)
+	{
+		prepareATAengine(&ataRowBack, data, dataWindows, stageDomain[1], stageExtent[1]);
+		prepareATAengine(&ataColBack, data, dataWindows, stageDomain[2], stageExtent[2]);
+	}
+	prepareFFTthreads(threads);
+	if (wisdomDir != NULL)
+	{ /* One file for each library, precision, grid and decomposition */
+		snprintf(wisdomFile, FILENAME_MAX, "%s/%s-%s-%dx%dx%d-d%d-%dx%d.wisdom", wisdomDir,
+		         FFT_NAME, PRECISION_NAME, extents[0], extents[1], extents[2],
+		         ((use2DFFT==1) ? 3 : decomp), decompDims[0], decompDims[1]);
+		loadWisdom(wisdomFile, commAll);
+	}
+	
+	/* Planning can take longer than the transforms, so it's timed too - *
+	 *  just the FFTs', with the transposes already set up above.        */
+	commSync(commAll);
+	planTime = MPI_Wtime();
+	prepareFFTs(data, decomp, use2DFFT, realInput, extents, stageExtent, stageDomain, ataCol.comm);
+	if (roundTrip == 1)
+		prepareInverseFFTs(data, use2DFFT, stageExtent, stageDomain);
+	if (pipelineDepth > 0)
+		prepareFFTbatch(data, stageExtent, stageDomain, pipelineDepth);
+	planTime = MPI_Wtime() - planTime;
+	doubleGlobalMax(&planTime, commAll);
 	
-	int skip    = 0;    /* Skip all work */
-	int skipFFT = 0;    /* Skip FFTs, just ATA */
-	int printOut= 0;    /* Print out the data instead of checking it at the end */
+	if (wisdomDir != NULL)
+		saveWisdom(wisdomFile, commAll);
 	
-	double phaseTime[6]; /* Tracks time for each phase of FFT */
+	/* What the transposes move, for their bandwidth - the inverse ones move *
+	 *  as much again. The library's own (-d0) aren't known.                 */
+	transposes   = 0;
+	bytesSent    = 0;
+	bytesOffNode = 0;
+	if (decomp == 2)
+	{
+		transposeVolume(&ataRow, node, &bytesSent, &bytesOffNode);
+		transposes++;
+	}
+	if (decomp != 0)
+	{
+		transposeVolume(&ataCol, node, &bytesSent, &bytesOffNode);
+		transposes++;
+	}
+	if (roundTrip == 1)
+	{
+		bytesSent    *= 2;
+		bytesOffNode *= 2;
+		transposes   *= 2;
+	}
+	doubleGlobalSum(&bytesSent, commAll);
+	doubleGlobalSum(&bytesOffNode, commAll);
+}
 
-    /*** How many times we run the test. ***/
-    int loopCount;
-    int targetLoopCount = 1;
+static void transformOnce(int loopCount)
+{ /* Runs the forward transform once, followed by the inverse for a round trip, and *
+   *  leaves how long each part took in the totals for the result line.            */
+	/* Populate the buffers with the real or test data. A round trip *
+	 *  gives back its input, so later ones just carry on from it.   */
+	if ( ( roundTrip == 0 ) || ( loopCount == 0 ) )
+	{
+		if ( ( skipFFT==1 ) || ( skip==1 ) )
+		{ /* If we're skipping bits, use the test data. */
+			makeTestData(data, extents, stageExtent[0], stageDomain[0], decompDims, cartCoords);	
+		} else {
+			makeData(data, extents, stageExtent[0], stageDomain[0], decompDims, cartCoords, realInput);	
+		}
+		
+		/* Both of the above fill data[0]. From here on, each step *
+		 *  tells us where it left its result.                    */
+		live = 0;
+	}
+	
+	pipeStats.fftTime  = 0;
+	pipeStats.waitTime = 0;
+	pipeStats.commSpan = 0;
+#ifdef SUBPHASE_TIMERS
+	resetTimers();
+#endif
+	
+	/* Barrier before we start */
+	commSync(commAll);
+	
+	/********* Actual FFTs **********/
+	
+	/* If !0, skip skips the whole operation, skipFFT skips any transforms */
 	
-	/*** MPI Variables ***/
-	int size;          /* Global number of tasks */
-	int cartCoords[2]; /* Coordinates within the Cartesian communicator */
-	int decompDims[2]; /* Number of processors along each dimension of the decomp */
+	phaseTime[0] = MPI_Wtime();
+	if ( (pipelineDepth > 0) && (decomp == 1) && (skip == 0) )
+	{ /* Slab type decomp, with the transpose pipelined into the FFTs either side */
+		if ( use2DFFT == 1 )
+		{
+			if (!skipFFT) live = perform2DFFT(data, live, stageExtent[0], stageDomain[0]);
+			phaseTime[1] = MPI_Wtime();
+			phaseTime[2] = phaseTime[1];
+			phaseTime[3] = phaseTime[1];
+			live = performPipelinedTranspose(data, live, stageDomain[1], stageExtent[1], &ataCol,
+			                                 NO_FFT, skipFFT ? NO_FFT : 2, &pipeStats);
+		}
+		else
+		{
+			if (!skipFFT) live = performFFTset(data, live, 0, stageExtent[0], stageDomain[0]);
+			phaseTime[1] = MPI_Wtime();
+			live = performSlabTranspose(data, live, stageDomain[0][0], stageExtent[0], stageDomain[0][1]);
+			phaseTime[2] = MPI_Wtime();
+			phaseTime[3] = phaseTime[2];
+			live = performPipelinedTranspose(data, live, stageDomain[1], stageExtent[1], &ataCol,
+			                                 skipFFT ? NO_FFT : 1, skipFFT ? NO_FFT : 2, &pipeStats);
+		}
+		phaseTime[4] = MPI_Wtime();
+	} else if ( (pipelineDepth > 0) && (decomp == 2) && (skip == 0) ) {
+		/* Rod decomp, pipelined. The middle FFTs are run as each row group *
+		 *  arrives, so the column transpose only overlaps with the last.   */
+		phaseTime[1] = phaseTime[0];
+		live = performPipelinedTranspose(data, live, stageDomain[0], stageExtent[0], &ataRow,
+		                                 skipFFT ? NO_FFT : 0, skipFFT ? NO_FFT : 1, &pipeStats);
+		phaseTime[2] = MPI_Wtime();
+		phaseTime[3] = phaseTime[2];
+		live = performPipelinedTranspose(data, live, stageDomain[1], stageExtent[1], &ataCol,
+		                                 NO_FFT, skipFFT ? NO_FFT : 2, &pipeStats);
+		phaseTime[4] = MPI_Wtime();
+	} else if ( (decomp == 1) && (skip == 0) )
+	{ /* Slab type decomp */
+		if ( use2DFFT == 1 )
+		{ /* With 2D FFT types in the slab dimensions */
+			/* Note - data operated on this way may be transposed. */
+			if (!skipFFT) live = perform2DFFT(data, live, stageExtent[0], stageDomain[0]);
+			phaseTime[1] = MPI_Wtime();
+			phaseTime[2] = phaseTime[1];
+			phaseTime[3] = phaseTime[1];
+		} 
+		else
+		{ /* With 1D FFT types in the slab dimensions */
+			if (!skipFFT) live = performFFTset(data, live, 0, stageExtent[0], stageDomain[0]);
+			phaseTime[1] = MPI_Wtime();
+			live = performSlabTranspose(data, live, stageDomain[0][0], stageExtent[0], stageDomain[0][1]);
+			phaseTime[2] = MPI_Wtime();
+			if (!skipFFT) live = performFFTset(data, live, 1, stageExtent[1], stageDomain[1]);
+		}
+		
+		phaseTime[3] = MPI_Wtime();
+		
+		live = performDistTranspose(data, live, stageDomain[1], stageExtent[1], &ataCol);
+		
+		phaseTime[4] = MPI_Wtime();
+		
+		if (!skipFFT) live = performFFTset(data, live, 2, stageExtent[2], stageDomain[2]);
+		
+	} else if ( (decomp == 2) && (skip == 0) ) { 
+		/* Rod decomp */
+		if (!skipFFT) live = performFFTset(data, live, 0, stageExtent[0], stageDomain[0]);
+		
+		phaseTime[1] = MPI_Wtime();
+
+		live = performDistTranspose(data, live, stageDomain[0], stageExtent[0], &ataRow);
+				
+		phaseTime[2] = MPI_Wtime();
+				
+		if (!skipFFT) live = performFFTset(data, live, 1, stageExtent[1], stageDomain[1]);
+		
+		phaseTime[3] = MPI_Wtime();
+		
+		live = performDistTranspose(data, live, stageDomain[1], stageExtent[1], &ataCol);
+		
+		phaseTime[4] = MPI_Wtime();
+		
+		if (!skipFFT) live = performFFTset(data, live, 2, stageExtent[2], stageDomain[2]);
+	} else if ( (decomp == 0) && (skip == 0) && ( skipFFT == 0 ) ) { 
+		/* Automatic Decomp */
+		phaseTime[1] = phaseTime[0];
+		phaseTime[2] = phaseTime[0];
+		phaseTime[3] = phaseTime[0];
+		phaseTime[4] = phaseTime[0];
+		
+		live = performAutomatic3DFFT(data, live, extents);
+	}
+	phaseTime[5] = MPI_Wtime();
+	
+	if (pipelineDepth > 0)
+	{ /* The FFTs and transposes are interleaved, so the pipeline times its FFTs *
+	   *  and the rest is counted as communication/memory reorg.                */
+		fftTime = (phaseTime[1] - phaseTime[0]) + pipeStats.fftTime;
+		reorgTime = (phaseTime[5] - phaseTime[0]) - fftTime;
+		exposedCommTime = pipeStats.waitTime;
+		hiddenComm = (pipeStats.commSpan > 0) ? 1.0 - pipeStats.waitTime / pipeStats.commSpan : 0;
+	} else {
+		reorgTime = (phaseTime[2] - phaseTime[1]) + 
+		            (phaseTime[4] - phaseTime[3]);
+		fftTime = (phaseTime[1] - phaseTime[0]) + 
+		          (phaseTime[3] - phaseTime[2]) +
+		          (phaseTime[5] - phaseTime[4]);
+		exposedCommTime = reorgTime;
+		hiddenComm = 0;
+	}
+	totalTime = phaseTime[5] - phaseTime[0];
+	
+	if ( (roundTrip == 1) && (skip == 0) )
+	{ /* The inverse runs the same steps backwards, each transpose undone by the *
+	   *  same kind of transpose on the shape it left (see                       *
+	   *  makeInverseDecomposition). It isn't pipelined, so all of its           *
+	   *  communication is exposed.                                              */
+		inverseTime[0] = MPI_Wtime();
+		if (!skipFFT) live = performInverseFFTset(data, live, 2, stageExtent[2], stageDomain[2]);
+		inverseTime[1] = MPI_Wtime();
+		live = performDistTranspose(data, live, stageDomain[2], stageExtent[2], &ataColBack);
+		inverseTime[2] = MPI_Wtime();
+		
+		if ( (decomp == 1) && (use2DFFT == 1) )
+		{
+			if (!skipFFT) live = performInverse2DFFT(data, live, stageExtent[0], stageDomain[0]);
+			inverseTime[3] = MPI_Wtime();
+			inverseTime[4] = inverseTime[3];
+		} else {
+			if (!skipFFT) live = performInverseFFTset(data, live, 1, stageExtent[1], stageDomain[1]);
+			inverseTime[3] = MPI_Wtime();
+			if (decomp == 1)
+				live = performSlabTranspose(data, live, stageDomain[1][0], stageExtent[1], stageDomain[1][1]);
+			else
+				live = performDistTranspose(data, live, stageDomain[1], stageExtent[1], &ataRowBack);
+			inverseTime[4] = MPI_Wtime();
+			if (!skipFFT) live = performInverseFFTset(data, live, 0, stageExtent[0], stageDomain[0]);
+		}
+		inverseTime[5] = MPI_Wtime();
+		
+		fftTime   += (inverseTime[1] - inverseTime[0]) + 
+		             (inverseTime[3] - inverseTime[2]) +
+		             (inverseTime[5] - inverseTime[4]);
+		reorgTime += (inverseTime[2] - inverseTime[1]) + 
+		             (inverseTime[4] - inverseTime[3]);
+		exposedCommTime += (inverseTime[2] - inverseTime[1]) + 
+		                   (inverseTime[4] - inverseTime[3]);
+		totalTime += inverseTime[5] - inverseTime[0];
+		
+		/* Neither way is normalised, so the round trip has scaled the data *
+		 *  up by the number of points. Undo that before the next one.      */
+		if (!skipFFT)
+			scaleData(data, live, 1.0 / ((double)extents[0] * (double)extents[1] * (double)extents[2]),
+			          stageExtent[0], stageDomain[0]);
+	}
+}
+
+static void gatherPhaseStatistics()
+{ /* Reduces how long each phase of the last transform took, on every processor, *
+   *  into phaseSpread - the forward phases, then the inverse ones after a round *
+   *  trip, then the whole transform - so that one slow processor shows up, not *
+   *  just whatever the master took.                                            */
+	double times[PHASES + 1];
+	int p;
+	
+	phaseCount = 0;
+	for(p=0;p<5;p++)
+		times[phaseCount++] = phaseTime[p + 1] - phaseTime[p];
+	if ( (roundTrip == 1) && (skip == 0) )
+	{
+		for(p=0;p<5;p++)
+			times[phaseCount++] = inverseTime[p + 1] - inverseTime[p];
+	}
+	times[phaseCount] = totalTime;
+	
+	phaseStatistics(times, phaseSpread, phaseCount + 1, node, commAll);
+#ifdef SUBPHASE_TIMERS
+	timerStatistics(subphaseSpread, subphaseBytes, node, commAll);
+#endif
+}
+
+static void gatherThroughput()
+{ /* Works out the rates for the result line from the slowest processor's times *
+   *  in phaseSpread. The FFTs are taken as the usual 5 N log2 N flops for N     *
+   *  points, half that for real input, though the fast ones do fewer; they're  *
+   *  over the whole transform, since the transposes are needed for them. The   *
+   *  bandwidths are over the distributed transposes' phases only.              */
+	double points = (double)extents[0] * (double)extents[1] * (double)extents[2];
+	double flops  = 5 * points * log2(points) * ((realInput == 1) ? 0.5 : 1) * ((roundTrip == 1) ? 2 : 1);
+	double transposeTime = 0;
+	
+	gflops = 0;
+	if ( (skip == 0) && (skipFFT == 0) && (phaseSpread[phaseCount].max > 0) )
+		gflops = flops / phaseSpread[phaseCount].max / 1e9;
+	
+	/* transpose-1 is local for slabs */
+	if ( (decomp == 2) && (skip == 0) ) transposeTime += phaseSpread[1].max;
+	if ( (decomp != 0) && (skip == 0) ) transposeTime += phaseSpread[3].max;
+	if ( phaseCount > 5 )
+	{
+		transposeTime += phaseSpread[6].max;
+		if (decomp == 2) transposeTime += phaseSpread[8].max;
+	}
+	
+	rankBandwidth = 0;
+	linkBandwidth = 0;
+	if (transposeTime > 0)
+	{
+		rankBandwidth = bytesSent / size / transposeTime / 1e9;
+		linkBandwidth = bytesOffNode / nodes / transposeTime / 1e9;
+	}
+}
+
+static void writeRunRecord(const char *decompName)
+{ /* Writes the first record of the run to the results file - the options, what *
+   *  the library and the benchmark were built as, and where each processor ran. *
+   *  Every processor has to call this, for the host names.                      */
+	jsonWriter json;
+	char *hostNames;
+	int *hostNodes;
+	int n, p;
+	
+	hostInfo(node, &hostNames, &hostNodes, commAll);
+	if (!amMaster(commAll)) return;
 	
-	MPI_Comm commAll = MPI_COMM_WORLD;
+	jsonBeginRecord(&json, resultsFile);
+	jsonString(&json, "record", "run");
+	jsonInt(&json, "version", RESULTS_VERSION);
+	jsonString(&json, "run", runId);
+	jsonString(&json, "started", runStarted);
 	
-	ataInfo ataRow, ataCol; /* Stored All-to-All information */
+	jsonOpenObject(&json, "options");
+	jsonOpenArray(&json, "extents");
+	for(p=0;p<3;p++) jsonInt(&json, NULL, extents[p]);
+	jsonCloseArray(&json);
+	jsonInt(&json, "decomposition", (use2DFFT == 1) ? 3 : decomp);
+	jsonOpenArray(&json, "grid");
+	for(p=0;p<2;p++) jsonInt(&json, NULL, procGrid[p]);
+	jsonCloseArray(&json);
+	jsonInt(&json, "nodeAware", nodeAware);
+	jsonString(&json, "engine", engineName(engine));
+	jsonString(&json, "packKernels", (packMethod == PACK_SCALAR) ? "scalar" : "blocked");
+	jsonInt(&json, "window", ataWindow);
+	jsonInt(&json, "pipelineDepth", pipelineDepth);
+	jsonInt(&json, "realInput", realInput);
+	jsonInt(&json, "roundTrip", roundTrip);
+	jsonInt(&json, "skip", skip);
+	jsonInt(&json, "skipFFT", skipFFT);
+	jsonInt(&json, "printOut", printOut);
+	jsonInt(&json, "loops", targetLoopCount);
+	jsonInt(&json, "warmUp", warmUp);
+	jsonInt(&json, "summarise", summarise);
+	jsonDouble(&json, "precision", precision);
+	jsonDouble(&json, "budget", budget);
+	jsonString(&json, "plannerEffort", plannerEffortName(plannerEffort));
+	jsonString(&json, "wisdomDirectory", wisdomDir);
+	jsonString(&json, "tuneDirectory", tuneDir);
+	jsonString(&json, "resultsFile", resultsFileName);
+	jsonCloseObject(&json);
+	
+	jsonOpenObject(&json, "library");
+	jsonString(&json, "name", FFT_NAME);
+	jsonString(&json, "version", libraryVersion());
+	jsonString(&json, "precision", PRECISION_NAME);
+	jsonDouble(&json, "planTime", planTime);
+	jsonString(&json, "wisdomFile", (wisdomDir != NULL) ? wisdomFile : NULL);
+	jsonCloseObject(&json);
+	
+	jsonOpenObject(&json, "build");
+	jsonString(&json, "compiler", BUILD_COMPILER);
+#ifdef __VERSION__
+	jsonString(&json, "compilerVersion", __VERSION__);
+#else
+	jsonString(&json, "compilerVersion", NULL);
+#endif
+	jsonString(&json, "flags", BUILD_FLAGS);
+#ifdef SUBPHASE_TIMERS
+	jsonInt(&json, "subphaseTimers", 1);
+#else
+	jsonInt(&json, "subphaseTimers", 0);
+#endif
+	jsonCloseObject(&json);
+	
+	jsonOpenObject(&json, "decomposition");
+	jsonString(&json, "name", decompName);
+	jsonInt(&json, "use2DFFT", use2DFFT);
+	jsonOpenArray(&json, "dims");
+	for(p=0;p<2;p++) jsonInt(&json, NULL, decompDims[p]);
+	jsonCloseArray(&json);
+	jsonInt(&json, "autotuned", (tuneDir != NULL) ? 1 : 0);
+	jsonString(&json, "tuneFile", (tuneDir != NULL) ? tuneFile : NULL);
+	jsonString(&json, "mapping", (nodeAware == 1) ? "node-aware" : "Cartesian");
+	jsonInt(&json, "rowsWithinNodes", rowsOnNode);
+	jsonDouble(&json, "loadImbalance", imbalance);
+	jsonOpenArray(&json, "localArray");
+	jsonInt(&json, NULL, stageDomain[0][1]);
+	jsonInt(&json, NULL, stageDomain[0][0]);
+	jsonInt(&json, NULL, stageExtent[0]);
+	jsonCloseArray(&json);
+	jsonCloseObject(&json);
+	
+	/* The hosts, by node, with the ranks on each */
+	jsonInt(&json, "processors", size);
+	jsonInt(&json, "threads", threads);
+	jsonInt(&json, "nodes", nodes);
+	jsonOpenArray(&json, "hosts");
+	for(n=0;n<nodes;n++)
+	{
+		jsonOpenObject(&json, NULL);
+		jsonInt(&json, "node", n);
+		for(p=0;p<size;p++)
+		{
+			if (hostNodes[p] != n) continue;
+			jsonString(&json, "name", hostNames + p * MPI_MAX_PROCESSOR_NAME);
+			break;
+		}
+		jsonOpenArray(&json, "ranks");
+		for(p=0;p<size;p++)
+		{
+			if (hostNodes[p] == n) jsonInt(&json, NULL, p);
+		}
+		jsonCloseArray(&json);
+		jsonCloseObject(&json);
+	}
+	jsonCloseArray(&json);
+	jsonEndRecord(&json);
+	
+	free(hostNames);
+	free(hostNodes);
+}
+
+static void writeIterationRecord(int iteration)
+{ /* Writes a record for the last timed transform to the results file, with *
+   *  what the result line has, and every phase as the fft-phase lines have  *
+   *  them. Only the master writes.                                          */
+	jsonWriter json;
+	int p;
+	
+	jsonBeginRecord(&json, resultsFile);
+	jsonString(&json, "record", "iteration");
+	jsonInt(&json, "version", RESULTS_VERSION);
+	jsonString(&json, "run", runId);
+	jsonInt(&json, "iteration", iteration);
+	
+	jsonDouble(&json, "reorgTime", reorgTime);
+	jsonDouble(&json, "fftTime", fftTime);
+	jsonDouble(&json, "totalTime", totalTime);
+	jsonDouble(&json, "exposedCommTime", exposedCommTime);
+	jsonDouble(&json, "hiddenComm", hiddenComm);
+	jsonDouble(&json, "slowestTotalTime", phaseSpread[phaseCount].max);
+	jsonDouble(&json, "timeImbalance", phaseSpread[phaseCount].imbalance);
+	jsonDouble(&json, "gflops", gflops);
+	jsonDouble(&json, "gflopsPerRank", gflops / size);
+	jsonDouble(&json, "transposeBytes", (transposes > 0) ? bytesSent / transposes : 0);
+	jsonDouble(&json, "bandwidthPerRank", rankBandwidth);
+	jsonDouble(&json, "bandwidthPerLink", linkBandwidth);
+	
+	jsonOpenArray(&json, "phases");
+	for(p=0;p<phaseCount;p++)
+	{
+		jsonOpenObject(&json, NULL);
+		jsonString(&json, "name", phaseNames[p]);
+		jsonDouble(&json, "min", phaseSpread[p].min);
+		jsonDouble(&json, "mean", phaseSpread[p].mean);
+		jsonDouble(&json, "max", phaseSpread[p].max);
+		jsonDouble(&json, "imbalance", phaseSpread[p].imbalance);
+		jsonInt(&json, "slowestRank", phaseSpread[p].slowestRank);
+		jsonInt(&json, "slowestNode", phaseSpread[p].slowestNode);
+		jsonCloseObject(&json);
+	}
+	jsonCloseArray(&json);
+	
+#ifdef SUBPHASE_TIMERS
+	jsonOpenArray(&json, "subphases");
+	for(p=0;p<TIMER_COUNT;p++)
+	{
+		jsonOpenObject(&json, NULL);
+		jsonString(&json, "name", timerName(p));
+		jsonDouble(&json, "min", subphaseSpread[p].min);
+		jsonDouble(&json, "mean", subphaseSpread[p].mean);
+		jsonDouble(&json, "max", subphaseSpread[p].max);
+		jsonDouble(&json, "imbalance", subphaseSpread[p].imbalance);
+		jsonDouble(&json, "bytes", subphaseBytes[p]);
+		jsonDouble(&json, "bandwidth", (subphaseSpread[p].mean > 0) ? subphaseBytes[p] / subphaseSpread[p].mean / 1e9 : 0);
+		jsonCloseObject(&json);
+	}
+	jsonCloseArray(&json);
+#endif
+	jsonEndRecord(&json);
+}
+
+static void writeSummaryRecord(double elapsed)
+{ /* Writes the summary the fft-summary lines give to the results file, taking *
+   *  elapsed seconds in all. Only the master writes.                          */
+	jsonWriter json;
+	sampleStats spread;
+	int p;
+	
+	jsonBeginRecord(&json, resultsFile);
+	jsonString(&json, "record", "summary");
+	jsonInt(&json, "version", RESULTS_VERSION);
+	jsonString(&json, "run", runId);
+	jsonDouble(&json, "elapsed", elapsed);
+	
+	jsonOpenArray(&json, "phases");
+	for(p=0;p<=phaseCount;p++)
+	{
+		sampleStatistics(samples + ((p < phaseCount) ? p : PHASES), sampleCount, PHASES + 1, &spread);
+		jsonOpenObject(&json, NULL);
+		jsonString(&json, "name", (p < phaseCount) ? phaseNames[p] : "total");
+		jsonInt(&json, "count", spread.count);
+		jsonDouble(&json, "median", spread.median);
+		jsonDouble(&json, "p10", spread.p10);
+		jsonDouble(&json, "p90", spread.p90);
+		jsonDouble(&json, "mean", spread.mean);
+		jsonDouble(&json, "stddev", spread.stddev);
+		jsonDouble(&json, "ciLow", spread.mean - spread.confidence);
+		jsonDouble(&json, "ciHigh", spread.mean + spread.confidence);
+		jsonCloseObject(&json);
+	}
+	jsonCloseArray(&json);
+	jsonEndRecord(&json);
+}
+
+static void keepSample()
+{ /* Adds the last transform's row to samples, which grows as it needs to. Its *
+   *  phases have already been reduced over the processors, so every one has    *
+   *  the same samples.                                                        */
+	double *row;
+	int p;
+	
+	if (sampleCount == sampleSpace)
+	{
+		sampleSpace = (sampleSpace == 0) ? 64 : 2 * sampleSpace;
+		if ( NULL == ( samples = realloc(samples, sampleSpace * (PHASES + 1) * sizeof(double)) ) )
+		{
+			fprintf(stderr, "Unable to alloc samples in routine keepSample (main.c)\n");
+			MPI_Abort(MPI_COMM_WORLD, 5);
+		}
+	}
+	
+	row = samples + sampleCount * (PHASES + 1);
+	for(p=0;p<PHASES;p++)
+		row[p] = (p < phaseCount) ? phaseSpread[p].max : 0;
+	row[PHASES] = phaseSpread[phaseCount].max;
+	sampleCount++;
+}
+
+static int keepMeasuring(int timed, double elapsed)
+{ /* Whether to run another timed transform, after timed of them in elapsed *
+   *  seconds. Without a summary, that's just -l of them. With one, it's at  *
+   *  least -l, then until the mean total time is precise enough or the      *
+   *  budget runs out, whichever comes first, or only the budget if there's  *
+   *  no precision - but never more than MAX_SAMPLES. elapsed must be the    *
+   *  same on every processor, so that they all stop together.              */
+	sampleStats total;
+	
+	if (summarise == 0)
+		return (timed < targetLoopCount) || (targetLoopCount < 0);
+	
+	if (timed < targetLoopCount) return 1;
+	if (timed >= MAX_SAMPLES) return 0;
+	if ( (budget > 0) && (elapsed >= budget) ) return 0;
+	
+	if (precision > 0)
+	{
+		sampleStatistics(samples + PHASES, sampleCount, PHASES + 1, &total);
+		return ( relativeError(&total) > precision );
+	}
+	return (budget > 0);
+}
+
+static void tearDownRun()
+{ /* Frees everything setUpRun made, so that another configuration can be set up. */
+	if (engine == ENGINE_SHARED)
+		cleanUpSharedData(dataWindows);
+	else
+		cleanUpData(data);
+	cleanUpFFTs(decomp, use2DFFT);
+	freeATAcommsHandles(&ataRow, &ataCol);
+	if (roundTrip == 1)
+		freeATAcommsHandles(&ataRowBack, &ataColBack);
+	MPI_Comm_free(&commAll);
+	commAll = MPI_COMM_WORLD;
+}
+
+static void autotune()
+{ /* Sets up each configuration listTuneConfigs comes up with in turn, and times a  *
+   *  few transforms with it, keeping the one that was quickest on the slowest       *
+   *  processor. The first transform warms up the caches and connections, and isn't *
+   *  counted. The choice is left in decomp, use2DFFT, engine and decompDims, and    *
+   *  kept in a tuning file for the same size on the same number of processors,     *
+   *  with the same options that change what the transposes move or how, which     *
+   *  later runs use instead of trying them all again.                              */
+	tuneConfig *configs, chosen;
+	int count, c, loop;
+	double time, bestTime = -1;
+	char name[64];
+	
+	count = listTuneConfigs(&configs, size, extents, realInput, roundTrip);
+	snprintf(tuneFile, FILENAME_MAX, "%s/%s-%s-%dx%dx%d-p%d-%s-%s-j%d-%s-%s-W%d.tune", tuneDir,
+	         FFT_NAME, PRECISION_NAME, extents[0], extents[1], extents[2], size,
+	         ((realInput == 1) ? "r2c" : "c2c"), ((roundTrip == 1) ? "roundtrip" : "forward"), threads,
+	         ((nodeAware == 1) ? "nodeaware" : "cartesian"),
+	         ((packMethod == PACK_SCALAR) ? "scalar" : "blocked"), ataWindow);
+	
+	if ( 0 == loadTuning(tuneFile, &chosen, configs, count, commAll) )
+	{
+		if (amMaster(commAll))
+			fprintf(stderr, "Autotuning over %d configurations:\n", count);
+		
+		for(c=0;c<count;c++)
+		{
+			decomp        = configs[c].decomp;
+			use2DFFT      = configs[c].use2DFFT;
+			engine        = configs[c].engine;
+			decompDims[0] = configs[c].decompDims[0];
+			decompDims[1] = configs[c].decompDims[1];
+			setUpRun();
+			
+			time = 0;
+			for(loop=0;loop<=TUNE_LOOPS;loop++)
+			{
+				transformOnce(loop);
+				doubleGlobalMax(&totalTime, commAll);
+				if (loop > 0) time += totalTime;
+			}
+			time /= TUNE_LOOPS;
+			
+			tearDownRun();
+			
+			if (amMaster(commAll))
+			{
+				tuneConfigName(name, &configs[c]);
+				fprintf(stderr, " %-40s\t%g s\n", name, time);
+			}
+			if ( ( bestTime < 0 ) || ( time < bestTime ) )
+			{
+				bestTime = time;
+				chosen   = configs[c];
+			}
+		}
+		
+		saveTuning(tuneFile, &chosen, bestTime, commAll);
+	}
+	
+	decomp        = chosen.decomp;
+	use2DFFT      = chosen.use2DFFT;
+	engine        = chosen.engine;
+	decompDims[0] = chosen.decompDims[0];
+	decompDims[1] = chosen.decompDims[1];
+	free(configs);
+}
+
+int main (int argc, char ** argv) {
+
+	char decompName[5]; /* For output string */
+
+    /*** How many times we run the test. ***/
+    int loopCount;
+    int timed = 0;              /*  - the ones after the warm-up            */
+    double measureStart = 0;    /*  - and when they began,                  */
+    double elapsed = 0;         /*  and how long they've taken, the longest */
+    sampleStats spread;         /*  any processor has                       */
+    int p;
+    int opened;                 /* Whether the results file could be        */
+    time_t now;
+    char hostName[MPI_MAX_PROCESSOR_NAME];
+    int hostNameLength;
 	
 	/********* Preparation **********/
 	
 	
 	/* Fire up the MPI handler and set standard variables. */
 	commsInit(&argc, &argv);
+	commAll = MPI_COMM_WORLD;
 	size = getSize(commAll);
 	
 	/* Get Command Line Options */
-	getOptions(&argc, &argv, &extent, &decomp, &use2DFFT, &skip, &skipFFT, &targetLoopCount, &printOut);
+	getOptions(&argc, &argv, extents, &decomp, &use2DFFT, &skip, &skipFFT, &targetLoopCount, &printOut, &packMethod, &engine, &pipelineDepth, &realInput, &roundTrip, &threads, &wisdomDir, &plannerEffort, &tuneDir, procGrid, &nodeAware, &ataWindow, &warmUp, &summarise, &precision, &budget, &resultsFileName);
 	
 	/* Check all the parameters before going ahead */
-	validateParameters(size,extent,decomp);
-
-	/* Prepares a whole bunch of stuff -            */
-	makeDecomposition(decompDims, domainSize, extent, decomp, 
-					  size, cartCoords, &ataRow, &ataCol, &commAll);
-
+	validateParameters(size,extents,decomp,engine,realInput,roundTrip,threads,(wisdomDir != NULL),
+	                   (tuneDir != NULL),pipelineDepth,procGrid,ataWindow);
+	validateMeasurement(targetLoopCount,warmUp,summarise,precision,budget);
+	threads = processThreads(threads);
 	
-	/* Create the buffers & FFT handlers to use for *
-     *  the FFTs.                                   *
-	 * prepareFFTs may destroy some of the data     *
-	 *  in the array, so we populate it later.      *
-     * We also want the population inside a loop    *
-     *  so we can run the benchmark repeatedly      *
-     *  without re-running the whole code.          */           
-	makeDataArrays(data, extent, domainSize);
-	prepareFFTs(data[0], decomp, use2DFFT, extent, domainSize, ataCol.comm);
+	if ( ( engine == ENGINE_PERSISTENT ) && ( 0 == persistentATAavailable() ) )
+	{ /* Not an error - the results line will just show the engine that ran. */
+		if (amMaster(commAll))
+			fprintf(stderr, "Persistent collectives aren't available in this MPI library - "
+			                "using the pack engine instead.\n");
+		engine = ENGINE_PACK;
+	}
+	
+	plannerEffort = setPlannerEffort(plannerEffort);
+	
+	/* The results file is opened once, up front, so that a bad name stops the *
+	 *  run before it's spent any time. Records are appended to what's there. */
+	if (resultsFileName != NULL)
+	{
+		opened = 1;
+		if (amMaster(commAll))
+		{
+			resultsFile = fopen(resultsFileName, "a");
+			opened = (resultsFile != NULL);
+			if (!opened)
+				fprintf(stderr, "Results could not be written to %s.\n", resultsFileName);
+			
+			/* Each record names the run by when it began, in UTC, and the master's *
+			 *  host and process, since runs sharing a file can start together.   */
+			now = time(NULL);
+			strftime(runStarted, sizeof(runStarted), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+			MPI_Get_processor_name(hostName, &hostNameLength);
+			snprintf(runId, sizeof(runId), "%s-%s-%ld", runStarted, hostName, (long)getpid());
+		}
+		MPI_Bcast(&opened, 1, MPI_INT, 0, commAll);
+		if (!opened)
+		{
+			commsEnd();
+			exit(2);
+		}
+	}
+	
+	/* The autotuner picks the decomposition, grid and engine, or they're as *
+	 *  given, with the squarest grid divide2Ddomain can make for rods if   *
+	 *  there's no -g.                                                      */
+	if (tuneDir != NULL)
+		autotune();
+	else
+	{
+		decompDims[0] = procGrid[0];
+		decompDims[1] = procGrid[1];
+	}
+	setUpRun();
+	
+	if ( ( extents[0] == extents[1] ) && ( extents[0] == extents[2] ) )
+		sprintf(sizeName, "%d", extents[0]);
+	else
+		sprintf(sizeName, "%dx%dx%d", extents[0], extents[1], extents[2]);
 	
 	/* Print out the job parameters in a human understandable format and continue */
 	if (amMaster(commAll))
@@ -92,144 +931,243 @@ int main (int argc, char ** argv) {
 			"Running MPI 3D FFT Benchmark with %d processors.\n"
 			" Problem size:  \t%dx%dx%d\n"
 			" Decomposition: \t%s: %dx%d\n"
+			" Process mapping:\t%s, %d of %d rows within a node, on %d nodes\n"
 			" Each array:    \t%dx%dx%d (%d bytes)\n"
+			" Load imbalance:\t%g\n"
 			" Library:       \t%s\n"
-			" Using 2D FFT call: \t%s\n",
+			" Precision:     \t%s\n"
+			" Threads per process:\t%d\n"
+			" Wisdom file:   \t%s\n"
+			" Planner effort:\t%s\n"
+			" Planning time: \t%g s\n"
+			" Using 2D FFT call: \t%s\n"
+			" Transform:     \t%s\n"
+			" Transpose engine: \t%s\n"
+			" Pack kernels:  \t%s\n",
 			size,
-			extent,extent,extent,
+			extents[0],extents[1],extents[2],
 			decompName,
 			decompDims[0],decompDims[1],
-			domainSize[1],domainSize[0],extent,
-            domainSize[1]*domainSize[0]*extent*sizeof(complexType),
+			((nodeAware==1)?"node-aware":"Cartesian"),
+			rowsOnNode, decompDims[1], nodes,
+			stageDomain[0][1],stageDomain[0][0],stageExtent[0],
+            stageDomain[0][1]*stageDomain[0][0]*stageExtent[0]*sizeof(complexType),
+			imbalance,
 			FFT_NAME,
-			((use2DFFT==1)?"yes":"no")
+			PRECISION_NAME,
+			threads,
+			((wisdomDir != NULL) ? wisdomFile : "none"),
+			plannerEffortName(plannerEffort),
+			planTime,
+			((use2DFFT==1)?"yes":"no"),
+			((realInput==1)?"real-to-complex":"complex-to-complex"),
+			engineName(engine),
+			((packMethod==PACK_SCALAR)?"scalar":"blocked")
 			);
 		if (skip == 1)
 			fprintf(stderr, " Skip is set, calculation will be skipped.\n");
 		if (skipFFT == 1)
 			fprintf(stderr, " SkipFFT is set, 1D FFTs will be skipped.\n");
+		if (pipelineDepth > 0)
+			fprintf(stderr, " Transposes are pipelined in %d groups.\n", pipelineDepth);
+		if (roundTrip == 1)
+			fprintf(stderr, " Each transform is followed by its inverse.\n");
+		if (tuneDir != NULL)
+			fprintf(stderr, " The decomposition and engine were autotuned - see %s.\n", tuneFile);
+		if (warmUp > 0)
+			fprintf(stderr, " %d untimed transforms warm up first.\n", warmUp);
+		if (summarise == 1)
+			fprintf(stderr, " The timed transforms are summarised at the end.\n");
+#ifdef SUBPHASE_TIMERS
+		fprintf(stderr, " Sub-phase timers are compiled in, and add to the times.\n");
+#endif
 	}
 
-    for (loopCount=0; (loopCount < targetLoopCount) || (targetLoopCount < 0); loopCount++) {
-        /* Populate the buffers with the real or test data. */
-        if ( ( skipFFT==1 ) || ( skip==1 ) )
-        { /* If we're skipping bits, use the test data. */
-            makeTestData(data, extent, domainSize, cartCoords);	
-        } else {
-            makeData(data, extent, domainSize, cartCoords);	
-        }
-        
-        
-        /* Barrier before we start */
-        commSync(commAll);
-        
-        /********* Actual FFTs **********/
-        
-        /* If !0, skip skips the whole operation, skipFFT skips any transforms */
-        
-        phaseTime[0] = MPI_Wtime();
-        if ( (decomp == 1) && (skip == 0) )
-        { /* Slab type decomp */
-            if ( use2DFFT == 1 )
-            { /* With 2D FFT types in the slab dimensions */
-                /* Note - data operated on this way may be transposed. */
-                if (!skipFFT) perform2DFFT(data[0], data[1], extent, domainSize);
-                phaseTime[1] = MPI_Wtime();
-                phaseTime[2] = phaseTime[1];
-                phaseTime[3] = phaseTime[1];
-            } 
-            else
-            { /* With 1D FFT types in the slab dimensions */
-                if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-                phaseTime[1] = MPI_Wtime();
-                performLocalTranspose(data[0], extent, domainSize[1]);
-                phaseTime[2] = MPI_Wtime();
-                if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-            }
-            
-            phaseTime[3] = MPI_Wtime();
-            
-            performDistTranspose(data[0], data[1], domainSize, extent, &ataCol);
-            
-            if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-            
-            phaseTime[4] = MPI_Wtime();
-            
-        } else if ( (decomp == 2) && (skip == 0) ) { 
-            /* Rod decomp */
-            if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-            
-            phaseTime[1] = MPI_Wtime();
-
-            performDistTranspose(data[0], data[1], domainSize, extent, &ataRow);
-                    
-            phaseTime[2] = MPI_Wtime();
-                    
-            if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-            
-            phaseTime[3] = MPI_Wtime();
-            
-            performDistTranspose(data[0], data[1], domainSize, extent, &ataCol);
-            
-            phaseTime[4] = MPI_Wtime();
-            
-            if (!skipFFT) performFFTset(data[0], data[1], extent, domainSize);
-        } else if ( (decomp == 0) && (skip == 0) && ( skipFFT == 0 ) ) { 
-            /* Automatic Decomp */
-            phaseTime[1] = phaseTime[0];
-            phaseTime[2] = phaseTime[0];
-            phaseTime[3] = phaseTime[0];
-            phaseTime[4] = phaseTime[0];
-            
-            performAutomatic3DFFT(data[0], data[1], extent, domainSize);
-        }
-        phaseTime[5] = MPI_Wtime();
-
+    if (resultsFileName != NULL)
+        writeRunRecord(decompName);
+    
+    /* Say what the lines below hold */
+    if (amMaster(commAll))
+    {
+        printf("fft-columns:%d,results,%s\n", RESULTS_VERSION, resultColumns);
+        printf("fft-columns:%d,phase,%s\n", RESULTS_VERSION, phaseColumns);
+#ifdef SUBPHASE_TIMERS
+        printf("fft-columns:%d,subphase,%s\n", RESULTS_VERSION, subphaseColumns);
+#endif
+        printf("fft-columns:%d,summary,%s\n", RESULTS_VERSION, summaryColumns);
+    }
+    
+    for (loopCount=0; (loopCount < warmUp) || keepMeasuring(timed, elapsed); loopCount++) {
+        if (loopCount == warmUp) measureStart = MPI_Wtime();
+        transformOnce(loopCount);
+        gatherPhaseStatistics();
+        gatherThroughput();
 
         /********* Output and finalisation **********/
         
-        if ( printOut == 1 )
-        { /* If we're requesting it, print the data instead. */
-            printData( data, extent, domainSize, decompDims, cartCoords );
+        if ( ( printOut == 1 ) && ( roundTrip == 1 ) )
+        { /* A round trip leaves the data shaped as it started. */
+            printData( data, live, stageExtent[0], stageDomain[0], decompDims, cartCoords );
+        } else if ( printOut == 1 ) { 
+            /* If we're requesting it, print the data instead. */
+            printData( data, live, stageExtent[2], stageDomain[2], decompDims, cartCoords );
         } else if ( ( skipFFT==1 ) || ( skip==1 ) ) {
             if (amMaster(commAll)) {
                 fprintf(stderr, "Skipping data checking because some steps have been skipped.\n");
             }
+        } else if ( roundTrip == 1 ) {
+            checkRoundTrip( data, live, extents, stageExtent[0], stageDomain[0], decompDims, cartCoords, 
+                            realInput, TOLERANCE, commAll );
         } else {
-            checkData( data, extent, domainSize, cartCoords, TOLERANCE, commAll );
+            checkData( data, live, stageExtent[2], stageDomain[2], stageGlobal[2], extents, decompDims, 
+                       cartCoords, realInput, TOLERANCE, commAll );
         }
         
-        /* Print out computer readable (CSV) job result string */
-        if (amMaster(commAll))
+        /* Print out computer readable (CSV) job result string, once warmed *
+         *  up, unless they're all to be summarised at the end               */
+        if ( amMaster(commAll) && (loopCount >= warmUp) && (summarise == 0) )
         {
-            printf("fft-results:%d,%d,%s,%s,%s,%g,%g,%g\n",
+            printf("fft-results:%d,%s,%s,%s,%s,%g,%g,%g,%s,%d,%g,%g,%g,%s,%s,%s,%d,%s,%g,%d,%g,%g,%g,%g,%g,%g,%g\n",
                 size,
-                extent,
+                sizeName,
                 decompName,
                 ((use2DFFT==1)?"2DFFT":"1DFFT"),
                 FFT_NAME,
                 
                 /* Communication/memory reorg time */ 
-                (phaseTime[2] - phaseTime[1]) + 
-                 (phaseTime[4] - phaseTime[3]),
+                reorgTime,
                 
                 /* FFT time */
-                (phaseTime[1] - phaseTime[0]) + 
-                 (phaseTime[3] - phaseTime[2])+
-                 (phaseTime[5] - phaseTime[4]),
+                fftTime,
                  
                  /* Total time */
-                phaseTime[5] - phaseTime[0]
+                totalTime,
+                
+                ((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+                pipelineDepth,
+                
+                /* Communication not hidden behind FFTs, and the fraction that was */
+                exposedCommTime,
+                hiddenComm,
+                
+                /* From uneven blocks */
+                imbalance,
+                
+                ((realInput==1)?"r2c":"c2c"),
+                ((roundTrip==1)?"roundtrip":"forward"),
+                PRECISION_NAME,
+                threads,
+                
+                /* How hard, and for how long, the FFTs were planned */
+                plannerEffortName(plannerEffort),
+                planTime,
+                
+                /* Messages in flight, for the windowed all-to-all */
+                ((engine == ENGINE_WINDOWED) ? ataWindow : 0),
+                
+                /* The slowest processor's total time, and how far it was over the mean */
+                phaseSpread[phaseCount].max,
+                phaseSpread[phaseCount].imbalance,
+                
+                /* How fast, in GFLOP/s, and for each processor */
+                gflops,
+                gflops / size,
+                
+                /* What each transpose moved between processors, and in GB/s *
+                 *  from each processor and out of each node                 */
+                ((transposes > 0) ? bytesSent / transposes : 0),
+                rankBandwidth,
+                linkBandwidth
                 );
+            
+            /* And the same for each phase, along with who was slowest */
+            for (p=0; p<phaseCount; p++) {
+                printf("fft-phase:%d,%s,%s,%s,%s,%g,%g,%g,%g,%d,%d\n",
+                    size,
+                    sizeName,
+                    decompName,
+                    ((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+                    phaseNames[p],
+                    phaseSpread[p].min,
+                    phaseSpread[p].mean,
+                    phaseSpread[p].max,
+                    phaseSpread[p].imbalance,
+                    phaseSpread[p].slowestRank,
+                    phaseSpread[p].slowestNode
+                    );
+            }
+#ifdef SUBPHASE_TIMERS
+            /* And for the steps inside them, with the bandwidth of those that move data */
+            for (p=0; p<TIMER_COUNT; p++) {
+                printf("fft-subphase:%d,%s,%s,%s,%s,%g,%g,%g,%g,%g,%g\n",
+                    size,
+                    sizeName,
+                    decompName,
+                    ((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+                    timerName(p),
+                    subphaseSpread[p].min,
+                    subphaseSpread[p].mean,
+                    subphaseSpread[p].max,
+                    subphaseSpread[p].imbalance,
+                    subphaseBytes[p],
+                    ((subphaseSpread[p].mean > 0) ? subphaseBytes[p] / subphaseSpread[p].mean / 1e9 : 0)
+                    );
+            }
+#endif
+        }
+        
+        if (loopCount >= warmUp)
+        {
+            if ( (resultsFile != NULL) && amMaster(commAll) )
+                writeIterationRecord(timed);
+            timed++;
+            if (summarise == 1)
+            {
+                keepSample();
+                elapsed = MPI_Wtime() - measureStart;
+                doubleGlobalMax(&elapsed, commAll);
+            }
         }
     } /* End benchmark loop */
+    
+    /* The summary - the spread of each phase's time, then the total's, *
+     *  on the slowest processor in each transform                      */
+    if ( (summarise == 1) && amMaster(commAll) )
+    {
+        sampleStatistics(samples + PHASES, sampleCount, PHASES + 1, &spread);
+        fprintf(stderr, "Timed %d transforms in %g s - the mean total time is %g s, to within %g%%.\n",
+                sampleCount, elapsed, spread.mean, 100 * relativeError(&spread));
+        
+        for (p=0; p<=phaseCount; p++) {
+            sampleStatistics(samples + ((p < phaseCount) ? p : PHASES), sampleCount, PHASES + 1, &spread);
+            printf("fft-summary:%d,%s,%s,%s,%s,%d,%g,%g,%g,%g,%g,%g,%g\n",
+                size,
+                sizeName,
+                decompName,
+                ((pipelineDepth > 0) ? "pipeline" : engineName(engine)),
+                ((p < phaseCount) ? phaseNames[p] : "total"),
+                spread.count,
+                spread.median,
+                spread.p10,
+                spread.p90,
+                spread.mean,
+                spread.stddev,
+                
+                /* The 95% confidence interval for the mean */
+                spread.mean - spread.confidence,
+                spread.mean + spread.confidence
+                );
+        }
+    }
+    if ( (summarise == 1) && (resultsFile != NULL) && amMaster(commAll) )
+        writeSummaryRecord(elapsed);
+    if (resultsFile != NULL)
+        fclose(resultsFile);
+    free(samples);
 	
 	/* Clean up all the parts */
-	cleanUpData(data);
-	cleanUpFFTs(decomp);
-	freeATAcommsHandles(&ataRow, &ataCol);
+	tearDownRun();
 	commsEnd();
 	
 	exit(0);
 }
-
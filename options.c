@@ -9,29 +9,44 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "libDefs.h"
+#include "comms.h"
+#include "A2A3D.h"
+#include "benchmarkLocalTranspose.h"
 #include "options.h"
 
 
-int getOptions(int *argc, char ***argv, int *extent, int *decompType, int *use2DFFT, int *skip, int *skipFFT, int *targetLoopCount, int *printOut)
+int getOptions(int *argc, char ***argv, int extents[3], int *decompType, int *use2DFFT, int *skip, int *skipFFT, int *targetLoopCount, int *printOut, int *packMethod, int *engine, int *pipelineDepth, int *realInput, int *roundTrip, int *threads, char **wisdomDir, int *plannerEffort, char **tuneDir, int grid[2], int *nodeAware, int *window, int *warmUp, int *summarise, double *precision, double *budget, char **resultsFile)
 {   /* Get command-line options */
 	
 	int c;
+	int fields; /* Numbers given to -x */
+	int e;
 	
 	/* Defaults for testing. */
 	*decompType = 1;
-	*extent = 4;
+	extents[0] = extents[1] = extents[2] = 4;
 	
 	
 	opterr = 0; /* Defined in unistd.h */
-	while ((c = getopt (*argc, *argv, "x:d:l:nhfLp")) != -1)
+	while ((c = getopt (*argc, *argv, "x:d:l:t:k:j:w:e:a:g:W:u:c:b:o:nhfiLmNprsT")) != -1)
 	{
 		switch (c)
 		{
-			/* argument -x sets the extent */
+			/* argument -x sets the extent - one number for a cube, *
+			 *  or NXxNYxNZ for a box.                              */
 			case 'x':
-			 *extent = atoi(optarg);
+			 fields = sscanf(optarg, "%dx%dx%d", &extents[0], &extents[1], &extents[2]);
+			 if (fields == 1)
+			 {
+				extents[1] = extents[0];
+				extents[2] = extents[0];
+			 } else if (fields != 3) {
+				fprintf(stderr, "Option -x takes one extent, or three as NXxNYxNZ.\n");
+				exit(1);
+			 }
 			 break;
 			 
 			/* -d sets type of decomposition */
@@ -48,32 +63,161 @@ int getOptions(int *argc, char ***argv, int *extent, int *decompType, int *use2D
 			 }
 			 break;
 
+			/* -g sets the processor grid for a rod decomposition, as PxQ, *
+			 *  P being the processors in each row transpose               */
+			case 'g':
+			 if (2 != sscanf(optarg, "%dx%d", &grid[0], &grid[1]))
+			 {
+				fprintf(stderr, "Option -g takes the processor grid as PxQ.\n");
+				exit(1);
+			 }
+			 break;
+
+			/* -t sets the transpose engine            *
+			 * 0 packs by hand and uses MPI_Alltoall   *
+			 * 1 uses MPI_Alltoallw with datatypes     *
+			 * 2 packs by hand and uses a persistent   *
+			 *   all-to-all, set up once               *
+			 * 3 packs by hand and gathers each node's *
+			 *   blocks for one all-to-all between     *
+			 *   the nodes                             *
+			 * 4 packs by hand and unpacks straight    *
+			 *   from the node's shared memory         *
+			 * 5 packs by hand and puts each block in  *
+			 *   its unpacked place with MPI_Put       *
+			 * 6-8 pack by hand and use one of our own *
+			 *   all-to-alls - see alltoall.c          */
+			case 't':
+			 *engine = atoi(optarg);
+			 break;
+
+			/* -W sets the messages engine 8 keeps in flight */
+			case 'W':
+			 *window = atoi(optarg);
+			 break;
+
+			/* -k pipelines the transposes in this many groups of pencils */
+			case 'k':
+			 *pipelineDepth = atoi(optarg);
+			 break;
+
+			/* -j sets the number of OpenMP threads in each process */
+			case 'j':
+			 *threads = atoi(optarg);
+			 break;
+
+			/* -w keeps the library's planning wisdom in this directory */
+			case 'w':
+			 *wisdomDir = optarg;
+			 break;
+
+			/* -e sets how hard the planner looks for fast FFTs, by name */
+			case 'e':
+			 *plannerEffort = -1;
+			 for(e=0;e<PLAN_EFFORT_COUNT;e++)
+			 {
+				if (0 == strcmp(optarg, plannerEffortName(e)))
+					*plannerEffort = e;
+			 }
+			 if (*plannerEffort == -1)
+			 {
+				fprintf(stderr, "Option -e takes estimate, measure, patient or exhaustive.\n");
+				exit(1);
+			 }
+			 break;
+
+			/* -a tries each decomposition, grid and engine, and keeps the *
+			 *  quickest in a tuning file in this directory               */
+			case 'a':
+			 *tuneDir = optarg;
+			 break;
+
             /* -l sets the number of times we repeat the whole benchmark. */
             case 'l':
              *targetLoopCount = atoi(optarg);
              break;
 
+			/* -u runs this many transforms first, untimed, to warm up */
+			case 'u':
+			 *warmUp = atoi(optarg);
+			 break;
+
+			/* -m summarises the timed transforms at the end, rather than *
+			 *  printing a line for each                                  */
+			case 'm':
+			 *summarise = 1;
+			 break;
+
+			/* -c carries on past -l transforms until the mean total time is *
+			 *  known to within this fraction - see relativeError            */
+			case 'c':
+			 *precision = atof(optarg);
+			 *summarise = 1;
+			 break;
+
+			/* -b carries on past -l transforms for up to this many seconds */
+			case 'b':
+			 *budget = atof(optarg);
+			 *summarise = 1;
+			 break;
+
+			/* -o appends the results to this file as JSON lines, as well */
+			case 'o':
+			 *resultsFile = optarg;
+			 break;
+
 			/* -L prints the FFT library used */
 			case 'L':
 			 printLib();
 			 exit(0);
 			 break;
 			 
+			/* -T runs the local transpose microbenchmark, on the master alone *
+			 *  so that no other processor competes for its memory bandwidth.  */
+			case 'T':
+			 if (amMaster(MPI_COMM_WORLD))
+			 	benchmarkLocalTranspose();
+			 commsEnd();
+			 exit(0);
+			 break;
+			 
 			/* -n makes the program skip all the actual work */
 			case 'n':
 			 *skip = 1;
 			 break;
 			 
+			/* -N places the processors so that each row transpose is within a node */
+			case 'N':
+			 *nodeAware = 1;
+			 break;
+			 
 			/* -f makes the program skip all the ffts */
 			case 'f':
 			 *skipFFT = 1;
 			 break; 
 			 
+			/* -i runs the inverse after each forward transform, and checks *
+			 *  that the round trip gives back the input                    */
+			case 'i':
+			 *roundTrip = 1;
+			 break;
+			 
 			/* -p prints data after operation rather than checking it */ 
 			case 'p':
 			 *printOut = 1;
 			 break; 
 			 
+			/* -r transforms real input, keeping only the non-redundant half *
+			 *  of the spectrum from the first FFTs on                       */
+			case 'r':
+			 *realInput = 1;
+			 break;
+			 
+			/* -s uses the original element-at-a-time pack/unpack loops */
+			case 's':
+			 *packMethod = PACK_SCALAR;
+			 break;
+			 
 			/* Prints a list of options */ 
 			case 'h':
 			 printOptionList();
@@ -82,7 +226,7 @@ int getOptions(int *argc, char ***argv, int *extent, int *decompType, int *use2D
 			  
 			/* Errant option handler */
 			case '?':
-			 if ((optopt == 'x')||(optopt == 'd'))
+			 if ((optopt == 'x')||(optopt == 'd')||(optopt == 't')||(optopt == 'k')||(optopt == 'j')||(optopt == 'w')||(optopt == 'e')||(optopt == 'a')||(optopt == 'g')||(optopt == 'W')||(optopt == 'u')||(optopt == 'c')||(optopt == 'b')||(optopt == 'o'))
 			 {
 			  fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 			  exit(1);
@@ -109,17 +253,88 @@ void printOptionList()
 {
 	printf("3D FFT benchmark options: \n"
 	       "  -x<number>     Sets the size on one side of the global data cube.\n"
+	       "  -x<NX>x<NY>x<NZ> Sets the size of a non-cubic grid, x being the\n"
+	       "                  contiguous axis, transformed first.\n"
 		   "  -d[0|1|2|3]    Sets the type of decomposition used:\n"
 		   "                   0 - automatic (not universally available)\n"
 		   "                   1 - slab\n"
 		   "                   2 - rod\n"
 		   "                   3 - slab with 2D FFTs used on each slab\n"
+		   "  -g<P>x<Q>      Spreads a rod decomposition over a P by Q grid of\n"
+		   "                  processors, P to each row transpose, rather than\n"
+		   "                  the squarest grid there is.\n"
+		   "  -N             Places the processors so that the ones in each row\n"
+		   "                  transpose share a node, if the nodes hold whole\n"
+		   "                  rows, rather than leaving it to MPI_Cart_create.\n"
            "  -l<number>     Number of times to repeat the whole core process. \n"
+		   "  -u<number>     Runs this many transforms first, untimed, to warm up\n"
+		   "                  the caches, connections and library.\n"
+		   "  -m             Prints one summary of the timed transforms, with\n"
+		   "                  the median, 10th and 90th percentiles, mean,\n"
+		   "                  standard deviation and 95%% confidence interval of\n"
+		   "                  each phase, rather than a line for each. Needs at\n"
+		   "                  least 2 (-l).\n"
+		   "  -c<fraction>   Carries on past -l until the mean total time is\n"
+		   "                  known to within this fraction of itself (95%%\n"
+		   "                  confidence), or -b runs out. Implies -m.\n"
+		   "  -b<seconds>    Carries on past -l, until -c is met if given, for no\n"
+		   "                  longer than this. Implies -m.\n"
+		   "  -t[0-8]        Sets the engine used for the distributed transposes:\n"
+		   "                   0 - pack, MPI_Alltoall, unpack\n"
+		   "                   1 - MPI_Alltoallw with derived datatypes\n"
+		   "                   2 - pack, persistent all-to-all (MPI-4), unpack\n"
+		   "                   3 - pack, all-to-all through one processor on\n"
+		   "                       each node, unpack\n"
+		   "                   4 - pack into memory shared across each node,\n"
+		   "                       unpack straight from there, and send and\n"
+		   "                       receive only between nodes\n"
+		   "                   5 - pack, MPI_Put each block where it's\n"
+		   "                       unpacked, with fences\n"
+		   "                   6 - pack, pairwise exchange, unpack\n"
+		   "                   7 - pack, Bruck's all-to-all, unpack\n"
+		   "                   8 - pack, a window of nonblocking sends and\n"
+		   "                       receives at a time, unpack\n"
+		   "  -W<number>     Messages engine 8 keeps in flight each way.\n"
+		   "                  Defaults to %d.\n"
+		   "  -k<number>     Pipelines each transpose with the FFTs around it, in\n"
+		   "                  this many groups of pencils, using MPI_Ialltoall.\n"
+		   "  -j<number>     Runs this many OpenMP threads in each process, for the\n"
+		   "                  FFTs and the copies around the transposes. Defaults\n"
+		   "                  to OMP_NUM_THREADS. (Needs an OPENMP=yes build.)\n"
+		   "  -w<directory>  Loads the FFT plans made by earlier runs of the same\n"
+		   "                  size and decomposition from here, and saves any new\n"
+		   "                  ones. (FFTW2 and FFTW3 only.)\n"
+		   "  -e<effort>     How hard the planner looks for fast FFTs - estimate,\n"
+		   "                  measure (the default), patient or exhaustive. FFTW2\n"
+		   "                  and ACML only estimate or measure, and MKL and ESSL\n"
+		   "                  always plan the same way.\n"
+		   "  -a<directory>  Autotunes - times a few transforms with each valid\n"
+		   "                  decomposition, processor grid and transpose engine,\n"
+		   "                  runs with the quickest, and keeps it in a tuning\n"
+		   "                  file here for later runs of the same size on the\n"
+		   "                  same number of processors, with the same -r, -i,\n"
+		   "                  -j, -N, -s and -W. Overrides -d and -t, and can't\n"
+		   "                  be used with -k.\n"
+		   "  -o<file>       Appends the results to this file too, as JSON lines -\n"
+		   "                  one with the options, library, build and hosts,\n"
+		   "                  then one for each timed transform, with its\n"
+		   "                  phases, and one for the summary, if there is one.\n"
 		   "  -f             Skips all FFT steps.\n"
 		   "  -n             Skips all FFT and communication steps.\n"
+		   "  -i             Runs the inverse after each forward transform, and\n"
+		   "                  checks the round trip gives back the input. Each\n"
+		   "                  repeat (-l) then carries on from the last one's\n"
+		   "                  result. The inverse transposes aren't pipelined.\n"
 		   "  -p             Prints data instead of checking.\n"
+		   "  -r             Transforms real input, real-to-complex along x, so\n"
+		   "                  only the nx/2+1 non-redundant modes are transposed.\n"
+		   "                  (Not available with ACML, ESSL or -d0.)\n"
+		   "  -s             Uses the scalar pack/unpack loops in the transposes.\n"
+		   "                  (Not used by pipelined transposes.)\n"
            "  -L             Print which FFT library was used to build this. \n"
-		   "  -h             Prints this message.\n"
-		   );
+		   "  -T             Benchmarks the local transpose against the naive loop,\n"
+		   "                  on the master only - the other processors just exit.\n"
+		   "  -h             Prints this message.\n",
+		   DEFAULT_ATA_WINDOW);
 }
 
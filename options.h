@@ -7,5 +7,5 @@
  *
  */
 
-int getOptions(int *argc, char ***argv, int *extent, int *decompType, int *use2DFFT, int *skip, int *skipFFT, int *targetLoopCount, int *printOut);
+int getOptions(int *argc, char ***argv, int extents[3], int *decompType, int *use2DFFT, int *skip, int *skipFFT, int *targetLoopCount, int *printOut, int *packMethod, int *engine, int *pipelineDepth, int *realInput, int *roundTrip, int *threads, char **wisdomDir, int *plannerEffort, char **tuneDir, int grid[2], int *nodeAware, int *window, int *warmUp, int *summarise, double *precision, double *budget, char **resultsFile);
 void printOptionList();
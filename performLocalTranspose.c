@@ -1,7 +1,7 @@
 /*
  *  performLocalTranspose.c
- *  Transposes numberOfSlabs slabs of extent*extent sized
- *   contiguous arrays of complexType data.
+ *  Transposes numberOfSlabs slabs of extent*extent (or rows*cols)
+ *   sized contiguous arrays of complexType data.
  *
  *  Created by Ian Kirker on 15/04/2008.
  *
@@ -9,9 +9,120 @@
 
 #include "libDefs.h"
 #include "performLocalTranspose.h"
+#include "timers.h"
 
-/* Transposes multiple extent*extent 2D complex arrays stored contiguously in memory. */
+#ifdef __AVX__
+	#include <immintrin.h>
+#endif
+
+/* Swaps the 2x2 block of complex numbers at a with the transpose of the *
+ *  one at b, both in rows of extent. With AVX, each row of a block is   *
+ *  one 256-bit register and the transposes are two lane permutes.      */
+static void swap2x2(complexType *a, complexType *b, int extent)
+{
+#ifdef __AVX__
+	if (sizeof(complexType) == 2 * sizeof(double))
+	{
+		__m256d a0 = _mm256_loadu_pd((double *)(a));
+		__m256d a1 = _mm256_loadu_pd((double *)(a + extent));
+		__m256d b0 = _mm256_loadu_pd((double *)(b));
+		__m256d b1 = _mm256_loadu_pd((double *)(b + extent));
+
+		_mm256_storeu_pd((double *)(b),          _mm256_permute2f128_pd(a0, a1, 0x20));
+		_mm256_storeu_pd((double *)(b + extent), _mm256_permute2f128_pd(a0, a1, 0x31));
+		_mm256_storeu_pd((double *)(a),          _mm256_permute2f128_pd(b0, b1, 0x20));
+		_mm256_storeu_pd((double *)(a + extent), _mm256_permute2f128_pd(b0, b1, 0x31));
+		return;
+	}
+#endif
+	{
+		/* Plain assignment works for every complexType we support, and a *
+		 *  two-double element moves as one 128-bit load or store.         */
+		complexType a00 = a[0], a01 = a[1], a10 = a[extent], a11 = a[extent + 1];
+
+		a[0]          = b[0];
+		a[1]          = b[extent];
+		a[extent]     = b[1];
+		a[extent + 1] = b[extent + 1];
+		b[0]          = a00;
+		b[1]          = a10;
+		b[extent]     = a01;
+		b[extent + 1] = a11;
+	}
+}
+
+/* Swaps the rows*cols tile at a with the transpose of the cols*rows tile at b. *
+ *  When a == b the tile is on the diagonal and only its upper half is walked. */
+static void swapTiles(complexType *a, complexType *b, int extent, int rows, int cols)
+{
+	int r, c, cStart;
+	int diagonal = (a == b);
+	complexType swap;
+
+	for(r=0;r+1<rows;r+=2)
+	{
+		cStart = 0;
+		if (diagonal)
+		{ /* The 2x2 block on the diagonal only has one pair to swap */
+			swap = a[r*extent + r + 1];
+			a[r*extent + r + 1] = a[(r + 1)*extent + r];
+			a[(r + 1)*extent + r] = swap;
+			cStart = r + 2;
+		}
+		for(c=cStart;c+1<cols;c+=2)
+		{
+			swap2x2(a + r*extent + c, b + c*extent + r, extent);
+		}
+		for(;c<cols;c++)
+		{ /* Odd column left over */
+			swap = a[r*extent + c];         a[r*extent + c] = b[c*extent + r];             b[c*extent + r] = swap;
+			swap = a[(r + 1)*extent + c];   a[(r + 1)*extent + c] = b[c*extent + r + 1];   b[c*extent + r + 1] = swap;
+		}
+	}
+	for(;r<rows;r++)
+	{ /* Odd row left over */
+		for(c=(diagonal ? r + 1 : 0);c<cols;c++)
+		{
+			swap = a[r*extent + c];
+			a[r*extent + c] = b[c*extent + r];
+			b[c*extent + r] = swap;
+		}
+	}
+}
+
+/* Transposes multiple extent*extent 2D complex arrays stored contiguously in memory. *
+ * Each slab is walked in LOCAL_TRANSPOSE_TILE squares, swapping each tile below the  *
+ *  diagonal with its mirror above it, so both tiles stay in cache while they're      *
+ *  swapped instead of one side being strided through a whole column at a time.       *
+ * Each band of tiles swaps with tiles no other band touches, so the bands can be     *
+ *  shared out between threads - dynamically, since they shrink along the slab.       */
 void performLocalTranspose(complexType *data, int extent, int numberOfSlabs)
+{
+	int i, ti, tj, rows, cols;
+	complexType *slab;
+
+	OMP_FOR(collapse(2) schedule(dynamic) private(tj, rows, cols, slab))
+	for(i=0;i<numberOfSlabs;i++)
+	{
+		for(ti=0;ti<extent;ti+=LOCAL_TRANSPOSE_TILE)
+		{
+			slab = data + (long)i*extent*extent;
+			rows = ( ti + LOCAL_TRANSPOSE_TILE < extent ) ? LOCAL_TRANSPOSE_TILE : extent - ti;
+
+			/* Diagonal tile */
+			swapTiles(slab + ti*extent + ti, slab + ti*extent + ti, extent, rows, rows);
+
+			for(tj=ti+LOCAL_TRANSPOSE_TILE;tj<extent;tj+=LOCAL_TRANSPOSE_TILE)
+			{
+				cols = ( tj + LOCAL_TRANSPOSE_TILE < extent ) ? LOCAL_TRANSPOSE_TILE : extent - tj;
+				swapTiles(slab + ti*extent + tj, slab + tj*extent + ti, extent, rows, cols);
+			}
+		}
+	}
+}
+
+/* The original element-by-element version, kept for comparison by the microbenchmark. */
+void performLocalTransposeNaive(complexType *data, int extent, int numberOfSlabs)
 {
 	int i,j,k;
 	for(i=0;i<numberOfSlabs;i++)
@@ -25,3 +136,53 @@ void performLocalTranspose(complexType *data, int extent, int numberOfSlabs)
 		}
 	}
 }
+
+/* Transposes multiple rows*cols 2D complex arrays stored contiguously in memory from *
+ *  dataIn into dataOut, which leaves cols*rows arrays. A rectangle can't be swapped  *
+ *  in place tile for tile, so this goes out of place, in the same tiles.             */
+void performLocalTransposeRect(complexType *dataIn, complexType *dataOut, int rows, int cols, 
+                               int numberOfSlabs)
+{
+	int i, ti, tj, r, c, rEnd, cEnd;
+	complexType *in, *out;
+
+	OMP_FOR(collapse(2) private(tj, r, c, rEnd, cEnd, in, out))
+	for(i=0;i<numberOfSlabs;i++)
+	{
+		for(ti=0;ti<rows;ti+=LOCAL_TRANSPOSE_TILE)
+		{
+			in  = dataIn  + (long)i*rows*cols;
+			out = dataOut + (long)i*rows*cols;
+			rEnd = ( ti + LOCAL_TRANSPOSE_TILE < rows ) ? ti + LOCAL_TRANSPOSE_TILE : rows;
+			for(tj=0;tj<cols;tj+=LOCAL_TRANSPOSE_TILE)
+			{
+				cEnd = ( tj + LOCAL_TRANSPOSE_TILE < cols ) ? tj + LOCAL_TRANSPOSE_TILE : cols;
+				for(c=tj;c<cEnd;c++)
+				{
+					for(r=ti;r<rEnd;r++)
+					{
+						out[c*rows + r] = in[r*cols + c];
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Transposes the slabs of the live buffer, in place when they are square and *
+ *  into the other buffer when they aren't. Returns the index of the buffer   *
+ *  holding the result.                                                       */
+int performSlabTranspose(complexType *data[2], int live, int rows, int cols, int numberOfSlabs)
+{
+	TIMER_START(TIMER_LOCAL);
+	if (rows == cols)
+	{
+		performLocalTranspose(data[live], rows, numberOfSlabs);
+		TIMER_STOP(TIMER_LOCAL, (double)rows * cols * numberOfSlabs * sizeof(complexType));
+		return live;
+	}
+	
+	performLocalTransposeRect(data[live], data[1 - live], rows, cols, numberOfSlabs);
+	TIMER_STOP(TIMER_LOCAL, (double)rows * cols * numberOfSlabs * sizeof(complexType));
+	return 1 - live;
+}
@@ -1,6 +1,6 @@
 /*
  *  performLocalTranspose.h
- *  Prototype for performLocalTranspose
+ *  Prototypes for performLocalTranspose and friends
  *
  *  Created by Ian Kirker on 15/04/2008.
  *
@@ -21,7 +21,15 @@
 
 #include "libDefs.h" /* For complexType and complexSwap definition */
 
+/* Side, in elements, of the square tiles swapped by performLocalTranspose. *
+ *  Two 32x32 tiles of complex doubles fill a 32KB L1 cache.               */
+#define LOCAL_TRANSPOSE_TILE 32
+
 void performLocalTranspose(complexType *data, int extent, int numberOfSlabs);
+void performLocalTransposeNaive(complexType *data, int extent, int numberOfSlabs);
+void performLocalTransposeRect(complexType *dataIn, complexType *dataOut, int rows, int cols, 
+                               int numberOfSlabs);
+int performSlabTranspose(complexType *data[2], int live, int rows, int cols, int numberOfSlabs);
 
 #define HEADER_PERFORMLOCALTRANSPOSE
 #endif
\ No newline at end of file
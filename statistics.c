@@ -0,0 +1,98 @@
+/*
+ *  statistics.c
+ *  Summarising the times of repeated transforms, for -m. The times have
+ *   already been reduced over the processors, so every processor gets the
+ *   same summary, and can decide the same way whether to carry on.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <mpi.h>
+#include "statistics.h"
+
+/* Student's t for a two-sided 95% interval, by degrees of freedom, *
+ *  which is near enough the normal distribution's beyond these.    */
+#define T_TABLE_SIZE 30
+static const double tTable[T_TABLE_SIZE] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+#define T_LIMIT 1.960
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	
+	return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, int count, double fraction)
+{ /* Interpolates between the two samples either side, so that the median *
+   *  of an even number of them is the mean of the middle two.           */
+	double position = fraction * (count - 1);
+	int below = (int)floor(position);
+	
+	if (below >= count - 1) return sorted[count - 1];
+	return sorted[below] + (position - below) * (sorted[below + 1] - sorted[below]);
+}
+
+void sampleStatistics(double *samples, int count, int stride, sampleStats *stats)
+{ /* Summarises count samples, each stride doubles after the last, so that one *
+   *  column of a table of them can be taken. The confidence interval is       *
+   *  Student's, which assumes the times are roughly normal - the median and   *
+   *  percentiles don't, so they're the ones to trust when a few are way out. */
+	double *sorted;
+	double sum = 0, squares = 0;
+	int i;
+	
+	stats->count      = count;
+	stats->median     = 0;
+	stats->p10        = 0;
+	stats->p90        = 0;
+	stats->mean       = 0;
+	stats->stddev     = 0;
+	stats->confidence = 0;
+	if (count < 1) return;
+	
+	if ( NULL == ( sorted = malloc(count * sizeof(double)) ) )
+	{
+		fprintf(stderr, "Unable to alloc samples in routine sampleStatistics (statistics.c)\n");
+		MPI_Abort(MPI_COMM_WORLD, 5);
+	}
+	
+	for(i=0;i<count;i++)
+	{
+		sorted[i] = samples[i * stride];
+		sum += sorted[i];
+	}
+	stats->mean = sum / count;
+	
+	for(i=0;i<count;i++)
+		squares += (sorted[i] - stats->mean) * (sorted[i] - stats->mean);
+	
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	stats->median = percentile(sorted, count, 0.5);
+	stats->p10    = percentile(sorted, count, 0.1);
+	stats->p90    = percentile(sorted, count, 0.9);
+	
+	/* One sample says nothing about the spread */
+	if (count > 1)
+	{
+		stats->stddev     = sqrt(squares / (count - 1));
+		stats->confidence = ( (count - 1 <= T_TABLE_SIZE) ? tTable[count - 2] : T_LIMIT ) 
+		                    * stats->stddev / sqrt(count);
+	}
+	
+	free(sorted);
+}
+
+double relativeError(sampleStats *stats)
+{ /* How far out the mean could be, as a fraction of it - all of it, *
+   *  for all we know, from one sample.                               */
+	if (stats->count < 2) return 1;
+	if (stats->mean <= 0) return 0;
+	return stats->confidence / stats->mean;
+}
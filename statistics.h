@@ -0,0 +1,21 @@
+/*
+ *  statistics.h
+ *  Summarising the times of repeated transforms, for -m.
+ *
+ */
+
+#ifndef HEADER_STATISTICS
+#define HEADER_STATISTICS
+
+/* How a set of timings is spread - see sampleStatistics */
+typedef struct {
+	int count;
+	double median, p10, p90;
+	double mean, stddev;
+	double confidence;  /* The mean is within this of the true one, 19 times out of 20 */
+} sampleStats;
+
+void sampleStatistics(double *samples, int count, int stride, sampleStats *stats);
+double relativeError(sampleStats *stats);
+
+#endif
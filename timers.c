@@ -0,0 +1,60 @@
+/*
+ *  timers.c
+ *  Named timers for the steps inside the transposes and FFTs - see timers.h.
+ *   The steps are timed through TIMER_START and TIMER_STOP, so that they
+ *   cost nothing unless built with TIMERS=yes.
+ *
+ */
+
+#include <stdio.h>
+#include <mpi.h>
+#include "comms.h"
+#include "timers.h"
+
+/* Only the master thread times anything, outside the parallel regions, *
+ *  so these needn't be per thread.                                     */
+static double started[TIMER_COUNT];
+static double elapsed[TIMER_COUNT];
+static double moved[TIMER_COUNT];  /* Bytes, for the bandwidth */
+
+static const char *timerNames[TIMER_COUNT] = { "pack", "wire", "unpack", "local-transpose", "fft" };
+
+void timerStart(int timer)
+{
+	started[timer] = MPI_Wtime();
+}
+
+void timerStop(int timer, double bytes)
+{
+	elapsed[timer] += MPI_Wtime() - started[timer];
+	moved[timer]   += bytes;
+}
+
+void resetTimers()
+{
+	int t;
+	
+	for(t=0;t<TIMER_COUNT;t++)
+	{
+		elapsed[t] = 0;
+		moved[t]   = 0;
+	}
+}
+
+const char *timerName(int timer)
+{
+	return timerNames[timer];
+}
+
+void timerStatistics(phaseStats *stats, double *bytes, int node, MPI_Comm comm)
+{ /* Reduces each timer since resetTimers over the processors of comm, as      *
+   *  phaseStatistics does, and leaves the mean bytes each moved in bytes.     *
+   *  stats and bytes need TIMER_COUNT entries. Every processor gets them.    */
+	int t;
+	
+	phaseStatistics(elapsed, stats, TIMER_COUNT, node, comm);
+	
+	MPI_Allreduce(moved, bytes, TIMER_COUNT, MPI_DOUBLE, MPI_SUM, comm);
+	for(t=0;t<TIMER_COUNT;t++)
+		bytes[t] /= getSize(comm);
+}
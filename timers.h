@@ -0,0 +1,39 @@
+/*
+ *  timers.h
+ *  Named timers for the steps inside the transposes and FFTs, finer than
+ *   the phases main times. They cost an MPI_Wtime either side of each
+ *   step, so they're only compiled in when built with TIMERS=yes.
+ *
+ */
+
+#ifndef HEADER_TIMERS
+#define HEADER_TIMERS
+
+#include <mpi.h>
+#include "comms.h"
+
+/* Sub-phase indicator - goes in TIMER_START and TIMER_STOP */
+#define TIMER_PACK   0 /* Rearranging into a block for each peer        */
+#define TIMER_WIRE   1 /* Inside MPI, moving the blocks between peers   */
+#define TIMER_UNPACK 2 /* Putting the blocks that arrived in place      */
+#define TIMER_LOCAL  3 /* The local transpose between slab FFTs          */
+#define TIMER_FFT    4 /* The library's FFTs                             */
+#define TIMER_COUNT  5
+
+/* bytes is how much the step moved, for its bandwidth, or 0 if that *
+ *  means nothing for it, as for the FFTs.                           */
+#ifdef SUBPHASE_TIMERS
+	#define TIMER_START(timer)       timerStart(timer)
+	#define TIMER_STOP(timer, bytes) timerStop(timer, bytes)
+#else
+	#define TIMER_START(timer)
+	#define TIMER_STOP(timer, bytes)
+#endif
+
+void timerStart(int timer);
+void timerStop(int timer, double bytes);
+void resetTimers();
+const char *timerName(int timer);
+void timerStatistics(phaseStats *stats, double *bytes, int node, MPI_Comm comm);
+
+#endif
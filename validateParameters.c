@@ -12,26 +12,16 @@
 #include <mpi.h>
 #include "libDefs.h"
 #include "comms.h"
+#include "A2A3D.h"
 #include "validateParameters.h"
 
-void validateParameters(int size, int extent, int decomp)
+void validateParameters(int size, int extents[3], int decomp, int engine, int realInput, int roundTrip, 
+                        int threads, int useWisdom, int autotune, int pipelineDepth, int grid[2], int window)
 {
-	int temp;
 	int failed = 0;
 	
-	/* Check for valid number of processors */
-	/*  It must be a power of two. */
-	temp = 1;
-	while(temp<size)
-	{
-		temp*=2;
-	}
-	if ( temp != size )
-	{
-		if (amMaster(MPI_COMM_WORLD))
-			fprintf(stderr, "Invalid number of processors specified - %d is not a power of 2.\n", size);
-		failed = 1;
-	}
+	/* Any number of processors will do - where an axis doesn't divide evenly *
+	 *  between them, some get one point more than others (see blockSize).   */
 	
 	/* Check valid decomp - must be either 0, 1 or 2 */
 	/* If 3 was passed, it has been altered to 1 in the options retrieval. */
@@ -54,35 +44,135 @@ void validateParameters(int size, int extent, int decomp)
 				                " automatic decomposition.\n" );
 			failed = 1;
 		}
+		
+		/* The libraries each leave the result in their own layout, which we *
+		 *  only know how to check when all the axes are the same.          */
+		if ( ( extents[0] != extents[1] ) || ( extents[0] != extents[2] ) )
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid extent specified - "
+				                "the automatic decomposition needs a cubic grid.\n");
+			failed = 1;
+		}
+		
+		/* ...and we can't be sure they share it out the way we do. */
+		if ( extents[2] % size != 0 )
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid extent specified - the automatic decomposition "
+				                "needs an extent that is a multiple of processor count.\n");
+			failed = 1;
+		}
 	}
 	
 	
-	/* Check valid extent */
-	
-	/* In a slab decomposition, the extent must divide by the number of processors. */
-	if (decomp == 1)
+	/* Check real input can be done */
+	if (realInput == 1)
 	{
-		if ( size * (extent/size) != extent )
+		if ( 0 == libraryHasRealTransforms() )
 		{
 			if (amMaster(MPI_COMM_WORLD))
-				fprintf(stderr, "Invalid extent specified - extent must be a multiple of processor count.\n");
+				fprintf(stderr, "Invalid transform specified - "
+				                "this library does not support real-to-complex FFTs here.\n");
 			failed = 1;
 		}
+		
+		/* The libraries' parallel real transforms each have their own padding. */
+		if (decomp == 0)
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid transform specified - "
+				                "the automatic decomposition can't take real input.\n");
+			failed = 1;
+		}
+	}
+	
+	/* The libraries' parallel FFTs leave the result in their own layout, which *
+	 *  we have no inverse transposes for.                                      */
+	if ( ( roundTrip == 1 ) && ( decomp == 0 ) )
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid round trip specified - "
+			                "the automatic decomposition has no inverse here.\n");
+		failed = 1;
+	}
+	
+	/* Check valid transpose engine */
+	if ((engine < 0) || (engine >= ENGINE_COUNT))
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid transpose engine specified - "
+			                "use -h to list the available engines.\n");
+		failed = 1;
+	}
+	
+	/* The windowed all-to-all needs at least one message in flight */
+	if (window < 1)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid window specified - %d messages can't be in flight.\n", window);
+		failed = 1;
 	}
 	
-	/* In a rod decomposition, the extent^2 must divide by the number of processors, *
-	 *  but in a way that makes sure we have rectangular domains across one face of  *
-	 *  the data cube. Because of our size = 2^n restriction, this means that our    *
-	 *  extent only has to be divisible by 2. */
-	if (decomp == 2)
+	/* Check plans can be saved */
+	if ( ( useWisdom == 1 ) && ( 0 == libraryHasWisdom() ) )
 	{
-		if ( 2 * (extent/2) != extent ) 
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid wisdom directory specified - "
+			                "this library can't save its plans.\n");
+		failed = 1;
+	}
+	
+	/* Check valid processor grid, if one was given */
+	if ( ( grid[0] != 0 ) || ( grid[1] != 0 ) )
+	{
+		if ( ( grid[0] < 1 ) || ( grid[1] < 1 ) || ( grid[0] * grid[1] != size ) )
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid processor grid specified - "
+				                "%dx%d isn't a grid of %d processors.\n", grid[0], grid[1], size);
+			failed = 1;
+		}
+		
+		if ( ( decomp != 2 ) || ( autotune == 1 ) )
 		{
 			if (amMaster(MPI_COMM_WORLD))
-				fprintf(stderr, "Invalid extent specified - extent must be divisible by 2.\n");
+				fprintf(stderr, "Invalid processor grid specified - "
+				                "only a rod decomposition can be given one, and not when autotuning.\n");
 			failed = 1;
 		}
-	};
+	}
+	
+	/* The autotuner's configurations aren't all ones that can be pipelined */
+	if ( ( autotune == 1 ) && ( pipelineDepth != 0 ) )
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid pipeline specified - "
+			                "the autotuner only tries transposes that aren't pipelined.\n");
+		failed = 1;
+	}
+	
+	/* Check valid thread count - 0 leaves it to OMP_NUM_THREADS */
+	if (threads < 0)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid thread count specified - %d is negative.\n", threads);
+		failed = 1;
+	}
+#ifndef _OPENMP
+	if (threads > 1)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid thread count specified - "
+			                "this executable was built without OpenMP.\n");
+		failed = 1;
+	}
+#endif
+	
+	/* Check valid extent */
+	
+	/* Every axis must be at least as long as the number of processors it's *
+	 *  spread over - makeDecomposition checks that once the grid is known. */
 	
 	if (failed == 1)
 	{
@@ -92,3 +182,104 @@ void validateParameters(int size, int extent, int decomp)
 	
 	return;
 };
+
+
+void validatePipeline(int pipelineDepth, int decomp, int engine, int stageDomain[3][2])
+{ /* Checked once the decomposition is known, since the groups have to *
+   *  divide the local domain evenly, at every stage. The local domains *
+   *  can differ, so each processor checks its own, says what's wrong   *
+   *  with it, and then they all agree on the outcome.                  */
+	int failed = 0;
+	int s;
+	
+	if (pipelineDepth < 0)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid pipeline depth specified - %d is negative.\n", pipelineDepth);
+		failed = 1;
+	}
+	
+	if (pipelineDepth > 0)
+	{
+		if (decomp == 0)
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid pipeline specified - "
+				                "the automatic decomposition can't be pipelined.\n");
+			failed = 1;
+		}
+		
+		if (engine != ENGINE_PACK)
+		{
+			if (amMaster(MPI_COMM_WORLD))
+				fprintf(stderr, "Invalid pipeline specified - "
+				                "pipelined transposes can't use another transpose engine.\n");
+			failed = 1;
+		}
+		
+		/* Column groups are bands of rows, and FFTs are batched by the band... */
+		for(s=0;s<3;s++)
+		{
+			if ( pipelineDepth * (stageDomain[s][0]/pipelineDepth) != stageDomain[s][0] )
+			{
+				fprintf(stderr, "Invalid pipeline depth specified - "
+				                "it must divide the %d rows in each plane.\n", stageDomain[s][0]);
+				failed = 1;
+				break;
+			}
+		}
+		
+		/* ...while row groups are runs of whole planes. */
+		if ( ( decomp == 2 ) && 
+		     ( pipelineDepth * (stageDomain[0][1]/pipelineDepth) != stageDomain[0][1] ) )
+		{
+			if (failed == 0)
+				fprintf(stderr, "Invalid pipeline depth specified - "
+				                "it must divide the %d planes in each domain.\n", stageDomain[0][1]);
+			failed = 1;
+		}
+	}
+	
+	MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	if (failed == 1)
+	{
+		commsEnd();
+		exit(2);
+	}
+}
+
+void validateMeasurement(int targetLoopCount, int warmUp, int summarise, double precision, double budget)
+{ /* Checks the options that decide how many transforms are run and timed, *
+   *  and what's printed about them. The same everywhere, so the master    *
+   *  says what's wrong on its own.                                        */
+	int failed = 0;
+	
+	if (warmUp < 0)
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid warm-up specified - %d transforms can't be run.\n", warmUp);
+		failed = 1;
+	}
+	
+	/* A summary needs a spread of times, and an end to them */
+	if ( ( summarise == 1 ) && ( targetLoopCount < 2 ) )
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid repeat count specified - "
+			                "summaries (-m, -c or -b) need at least 2 timed transforms (-l).\n");
+		failed = 1;
+	}
+	
+	if ( ( precision < 0 ) || ( budget < 0 ) )
+	{
+		if (amMaster(MPI_COMM_WORLD))
+			fprintf(stderr, "Invalid precision or time budget specified - neither can be negative.\n");
+		failed = 1;
+	}
+	
+	if (failed == 1)
+	{
+		commsEnd();
+		exit(2);
+	}
+}
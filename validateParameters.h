@@ -7,7 +7,10 @@
  */
 #ifndef HEADER_VALIDATEPARAMETERS
 
-void validateParameters(int size, int extent, int decomp);
+void validateParameters(int size, int extents[3], int decomp, int engine, int realInput, int roundTrip, 
+                        int threads, int useWisdom, int autotune, int pipelineDepth, int grid[2], int window);
+void validatePipeline(int pipelineDepth, int decomp, int engine, int stageDomain[3][2]);
+void validateMeasurement(int targetLoopCount, int warmUp, int summarise, double precision, double budget);
 
 #define HEADER_VALIDATEPARAMETERS
 #endif
\ No newline at end of file